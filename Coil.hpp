@@ -17,6 +17,7 @@
 
 // user headers
 #include "util.hpp"
+#include "WireSegments.hpp"
 
 
 
@@ -33,14 +34,17 @@ public:
   Coil(float l, float r, int N, float orientation, cv::Point2d pos, float offset,float res, float dt);
 
   std::vector<FieldVector> coil_wire_vectors;
+  WireSegments coil_segments;
+  WireSegmentsFloat coil_segments_float; // Same segments for the float precisions
   void update(float time);
   void setCurrent(float);
-
-  cv::Vec3d calcFieldStrength(FieldVector, cv::Vec3d);
-  cv::Vec3d getFieldVectorAtPos(cv::Vec3d);
-  cv::Vec3d forceOnWireDL(FieldVector, float);
-  cv::Mat renderCoil_yz(cv::Mat& canvas);
-  cv::Mat renderCoil_xz(cv::Mat& canvas);
-  cv::Mat renderCoil_xy(cv::Mat& canvas);
+  size_t getBytes() const; // Heap bytes held
+
+  cv::Vec3d calcFieldStrength(const FieldVector&, const cv::Vec3d&) const;
+  cv::Vec3d getFieldVectorAtPos(const cv::Vec3d&, FieldPrecision = PRECISION_DOUBLE) const;
+  cv::Vec3d forceOnWireDL(const FieldVector&, float) const;
+  cv::Mat renderCoil_yz(cv::Mat& canvas) const;
+  cv::Mat renderCoil_xz(cv::Mat& canvas) const;
+  cv::Mat renderCoil_xy(cv::Mat& canvas) const;
 };
 
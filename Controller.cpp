@@ -1,9 +1,13 @@
+
 // stdlib
 #include <iostream>
 #include <stdio.h>
 #include <stdlib.h>
 #include <cmath>
 #include <iomanip>
+#include <algorithm>
+#include <thread>
+#include <atomic>
 
 // opencv
 #include <opencv2/core/core.hpp>
@@ -20,4 +24,324 @@
 #include "World.hpp"
 #include "Controller.hpp"
 
+// Lanes per chunk handed to a worker thread
+#define CONTROLLER_BATCH_CHUNK 16
+
+
+
+// dq frame with the q axis along the torque vector, falls back to the rotor angle where the map has no torque
+static void torqueFrame(const cv::Vec2f& torque_vector, double rotor_angle, double& cos_e, double& sin_e, double& torque_constant){
+  torque_constant = sqrt(torque_vector[0]*torque_vector[0] + torque_vector[1]*torque_vector[1]);
+  if(torque_constant > 0){
+    cos_e = torque_vector[1] / torque_constant;
+    sin_e = -torque_vector[0] / torque_constant;
+  }else{
+    cos_e = cos(rotor_angle);
+    sin_e = sin(rotor_angle);
+  }
+}
+
+
+// Scalar PI step, the integral is only kept when the output is unsaturated or the error pulls it back
+static double piStep(double error, double kp, double ki, double& integral, double limit, double dt){
+  double candidate = integral + ki * error * dt;
+  double output = kp * error + candidate;
+  if(fabs(output) <= limit || output * error < 0){
+    integral = candidate;
+  }
+  return std::min(std::max(kp * error + integral, -limit), limit);
+}
+
+
+// dq PI step limited to a circle, integrals hold while the voltage vector is saturated
+static cv::Vec2d piStepCircle(cv::Vec2d error, double kp, double ki, cv::Vec2d& integral, double limit, double dt){
+  cv::Vec2d candidate = integral + ki * dt * error;
+  cv::Vec2d output = kp * error + candidate;
+  double magnitude = cv::norm(output);
+  if(magnitude <= limit){
+    integral = candidate;
+    return output;
+  }
+  output = kp * error + integral;
+  magnitude = cv::norm(output);
+  return (magnitude > limit) ? output * (limit / magnitude) : output;
+}
+
+
+
+Controller::Controller(){}
+
+
+Controller::Controller(ControllerGains _gains, ControllerLimits _limits) :
+  gains(_gains), limits(_limits)
+{}
+
+
+void Controller::update(Motor& motor, float dt){
+  TorqueMap& torque_map = motor.getTorqueMap();
+  if(!torque_map.isValid()){
+    torque_map.generate(motor);
+  }
+
+  double cos_e, sin_e, torque_constant;
+  torqueFrame(torque_map.getTorqueVector(motor.getAngle()), motor.getAngle(), cos_e, sin_e, torque_constant);
+
+  // Speed loop, q current limited to what the d current leaves
+  double q_limit = sqrt(std::max<double>(limits.max_current*limits.max_current - d_current_reference*d_current_reference, 0));
+  double q_reference = piStep(speed_reference - motor.getSpeed(), gains.speed_kp, gains.speed_ki, speed_integral, q_limit, dt);
+  current_reference = cv::Vec2d(d_current_reference, q_reference);
+
+  motor.setVoltageDriven(!current_driven);
+  if(current_driven){
+    motor.setCurrentVector(parkInv(current_reference, cos_e, sin_e));
+    return;
+  }
+
+  // Current loops
+  cv::Vec2d current_dq = park(motor.getCurrentVector(), cos_e, sin_e);
+  voltage_command = piStepCircle(current_reference - current_dq, gains.current_kp, gains.current_ki, current_integral, limits.max_voltage, dt);
+  cv::Vec3d voltages = clarkInv(parkInv(voltage_command, cos_e, sin_e));
+  motor.setVoltages(voltages[0], voltages[1], voltages[2]);
+}
+
+
+void Controller::reset(){
+  speed_integral = 0;
+  current_integral = cv::Vec2d(0, 0);
+  current_reference = cv::Vec2d(0, 0);
+  voltage_command = cv::Vec2d(0, 0);
+}
+
+
+// Set methods
+void Controller::setEnabled(bool _enabled){
+  enabled = _enabled;
+}
+
+
+void Controller::setCurrentDriven(bool _current_driven){
+  current_driven = _current_driven;
+}
+
+
+void Controller::setGains(ControllerGains _gains){
+  gains = _gains;
+}
+
+
+void Controller::setLimits(ControllerLimits _limits){
+  limits = _limits;
+}
+
+
+void Controller::setSpeedReference(float _speed_reference){
+  speed_reference = _speed_reference;
+}
+
+
+void Controller::setDCurrentReference(float _d_current_reference){
+  d_current_reference = _d_current_reference;
+}
+
+
+// Get methods
+bool Controller::isEnabled() const {
+  return enabled;
+}
+
+
+ControllerGains Controller::getGains() const {
+  return gains;
+}
+
+
+cv::Vec2d Controller::getCurrentReference() const {
+  return current_reference;
+}
+
+
+cv::Vec2d Controller::getVoltageCommand() const {
+  return voltage_command;
+}
+
+
+
+void ControllerBatch::add(const ControllerGains& gains){
+  current_kp.push_back(gains.current_kp);
+  current_ki.push_back(gains.current_ki);
+  speed_kp.push_back(gains.speed_kp);
+  speed_ki.push_back(gains.speed_ki);
+
+  AlignedVector* state[] = {&angle, &speed, &i_d, &i_q, &speed_integral, &d_integral, &q_integral, &electrical_angle, &speed_error_ise, &peak_current};
+  for(AlignedVector* values : state){
+    values->push_back(0);
+  }
+}
+
+
+void ControllerBatch::clear(){
+  AlignedVector* lanes[] = {&current_kp, &current_ki, &speed_kp, &speed_ki, &angle, &speed, &i_d, &i_q, &speed_integral, &d_integral, &q_integral, &electrical_angle, &speed_error_ise, &peak_current};
+  for(AlignedVector* values : lanes){
+    values->clear();
+  }
+}
+
+
+size_t ControllerBatch::size() const {
+  return current_kp.size();
+}
+
+
+void ControllerBatch::run(Motor& motor, float speed_reference, float duration, float dt){
+  /*
+    Every lane starts from the motor's current rotor angle and speed with zero current.
+    The motor itself is not stepped, only its torque map, inertia, damping and load are read.
+   */
+  TorqueMap& torque_map = motor.getTorqueMap();
+  if(!torque_map.isValid()){
+    torque_map.generate(motor);
+  }
+
+  for(size_t lane = 0; lane < size(); lane++){
+    angle[lane] = motor.getAngle();
+    speed[lane] = motor.getSpeed();
+    i_d[lane] = i_q[lane] = 0;
+    speed_integral[lane] = d_integral[lane] = q_integral[lane] = 0;
+    speed_error_ise[lane] = peak_current[lane] = 0;
+    double cos_e, sin_e, torque_constant;
+    torqueFrame(torque_map.getTorqueVector(angle[lane]), angle[lane], cos_e, sin_e, torque_constant);
+    electrical_angle[lane] = atan2(sin_e, cos_e);
+  }
+
+  size_t chunk_num = (size() + CONTROLLER_BATCH_CHUNK - 1) / CONTROLLER_BATCH_CHUNK;
+  std::atomic<size_t> next_chunk(0);
+
+  auto worker = [&](){
+    for(size_t chunk = next_chunk++; chunk < chunk_num; chunk = next_chunk++){
+      size_t begin = chunk * CONTROLLER_BATCH_CHUNK;
+      runLanes(motor, begin, std::min<size_t>(begin + CONTROLLER_BATCH_CHUNK, size()), speed_reference, duration, dt);
+    }
+  };
+
+  if(thread_count == 1){
+    worker();
+    return;
+  }
+
+  std::vector<std::thread> workers;
+  for(int i = 0; i < thread_count; i++){
+    workers.emplace_back(worker);
+  }
+  for(int i = 0; i < workers.size(); i++){
+    workers[i].join();
+  }
+}
+
+
+void ControllerBatch::runLanes(const Motor& motor, size_t begin, size_t end, float speed_reference, float duration, float dt){
+  /*
+    Per lane and step:
+      speed PI -> i_q reference, dq current PI -> dq voltage,
+      L di/dt = v - R i + cross coupling - back-EMF, J dw/dt = k i_q - b w - T_load.
+    The torque constant k is the torque map's torque per ampere along q, back-EMF on q is 2/3 k w by power balance.
+    Currents and speed use semi-implicit Euler, so dt has to resolve L/R.
+   */
+  const TorqueMap& torque_map = motor.getTorqueMap();
+  double inertia = motor.getInertia();
+  double damping = motor.getDamping();
+  double load_torque = motor.getLoadTorque();
+  double resistance = plant.resistance;
+  double inductance = plant.inductance;
+  double max_current = limits.max_current;
+  double max_voltage = limits.max_voltage;
+  long steps = lround(duration / dt);
+
+  for(long step = 0; step < steps; step++){
+    for(size_t lane = begin; lane < end; lane++){
+      double cos_e, sin_e, torque_constant;
+      torqueFrame(torque_map.getTorqueVector(angle[lane]), angle[lane], cos_e, sin_e, torque_constant);
+
+      // Frame rate from the change in electrical angle, wrapped to (-pi, pi]
+      double theta_e = atan2(sin_e, cos_e);
+      double delta_e = remainder(theta_e - electrical_angle[lane], 2 * M_PI);
+      double electrical_speed = delta_e / dt;
+      electrical_angle[lane] = theta_e;
+
+      // Speed loop
+      double speed_error = speed_reference - speed[lane];
+      double q_reference = piStep(speed_error, speed_kp[lane], speed_ki[lane], speed_integral[lane], max_current, dt);
+
+      // Current loops
+      cv::Vec2d integral(d_integral[lane], q_integral[lane]);
+      cv::Vec2d voltage = piStepCircle(cv::Vec2d(-i_d[lane], q_reference - i_q[lane]), current_kp[lane], current_ki[lane], integral, max_voltage, dt);
+      d_integral[lane] = integral[0];
+      q_integral[lane] = integral[1];
+
+      // Electrical plant
+      double back_emf = 2.0 / 3.0 * torque_constant * speed[lane];
+      double d_rate = (voltage[0] - resistance * i_d[lane] + electrical_speed * inductance * i_q[lane]) / inductance;
+      double q_rate = (voltage[1] - resistance * i_q[lane] - electrical_speed * inductance * i_d[lane] - back_emf) / inductance;
+      i_d[lane] += dt * d_rate;
+      i_q[lane] += dt * q_rate;
+
+      // Mechanics
+      double acceleration = (torque_constant * i_q[lane] - damping * speed[lane] - load_torque) / inertia;
+      speed[lane] += dt * acceleration;
+      angle[lane] = fmod(angle[lane] + dt * speed[lane], 2 * M_PI);
+      if(angle[lane] < 0){
+        angle[lane] += 2 * M_PI;
+      }
+
+      // Score
+      speed_error_ise[lane] += speed_error * speed_error * dt;
+      peak_current[lane] = std::max<double>(peak_current[lane], sqrt(i_d[lane]*i_d[lane] + i_q[lane]*i_q[lane]));
+    }
+  }
+}
+
+
+// Set methods
+void ControllerBatch::setLimits(ControllerLimits _limits){
+  limits = _limits;
+}
+
+
+void ControllerBatch::setPlant(PlantParameters _plant){
+  plant = _plant;
+}
+
+
+void ControllerBatch::setThreadCount(int _thread_count){
+  thread_count = std::max(1, _thread_count);
+}
+
+
+// Get methods
+ControllerGains ControllerBatch::getGains(size_t lane) const {
+  ControllerGains gains;
+  gains.current_kp = current_kp[lane];
+  gains.current_ki = current_ki[lane];
+  gains.speed_kp = speed_kp[lane];
+  gains.speed_ki = speed_ki[lane];
+  return gains;
+}
+
+
+float ControllerBatch::getSpeedISE(size_t lane) const {
+  return speed_error_ise[lane];
+}
+
+
+float ControllerBatch::getPeakCurrent(size_t lane) const {
+  return peak_current[lane];
+}
+
+
+float ControllerBatch::getFinalSpeed(size_t lane) const {
+  return speed[lane];
+}
+
 
+size_t ControllerBatch::getBestLane() const {
+  return std::min_element(speed_error_ise.begin(), speed_error_ise.end()) - speed_error_ise.begin();
+}
@@ -17,12 +17,109 @@
 
 // user headers
 #include "util.hpp"
+#include "WireSegments.hpp"
 
 
+class Motor;
 
+
+struct ControllerGains {
+  float current_kp = 1;
+  float current_ki = 100;
+  float speed_kp = 1;
+  float speed_ki = 10;
+};
+
+
+struct ControllerLimits {
+  float max_current = 300; // Magnitude of the dq current reference
+  float max_voltage = 48; // Magnitude of the dq voltage command
+};
+
+
+// First order dq plant the batch sweep simulates the current loops against
+struct PlantParameters {
+  float resistance = 0.1;
+  float inductance = 0.001;
+};
+
+
+/*
+  Field oriented controller: a speed PI loop sets the q current, PI loops on the dq currents set the dq voltage.
+  The dq frame is taken from the torque map with the q axis along the torque vector, so only i_q produces torque.
+  Integrators use conditional integration: they hold while the output is saturated and the error pushes further out.
+  When current driven the current reference is applied to the motor directly and the current loops are bypassed,
+  otherwise the motor is switched to voltage drive and its phase model turns the voltages into currents.
+ */
 class Controller {
+  ControllerGains gains;
+  ControllerLimits limits;
+  bool enabled = false;
+  bool current_driven = true;
+  float speed_reference = 0;
+  float d_current_reference = 0;
+  double speed_integral = 0;
+  cv::Vec2d current_integral; // dq
+  cv::Vec2d current_reference; // dq
+  cv::Vec2d voltage_command; // dq
 
 public:
-  
+  Controller();
+  Controller(ControllerGains, ControllerLimits);
+  void update(Motor&, float dt);
+  void reset();
+
+  // Set
+  void setEnabled(bool);
+  void setCurrentDriven(bool);
+  void setGains(ControllerGains);
+  void setLimits(ControllerLimits);
+  void setSpeedReference(float);
+  void setDCurrentReference(float);
+
+  // Get
+  bool isEnabled() const;
+  ControllerGains getGains() const;
+  cv::Vec2d getCurrentReference() const;
+  cv::Vec2d getVoltageCommand() const;
 };
 
+
+/*
+  Many controller gain sets stepped side by side against the same motor model, for tuning sweeps.
+  Every lane owns its rotor and dq current state, stored as structure of arrays.
+  Lanes are split into chunks that worker threads pull from a shared counter; each chunk runs the whole horizon.
+  Torque comes from the motor's torque map, the currents from a first order RL plant with back-EMF from the same map.
+ */
+class ControllerBatch {
+  ControllerLimits limits;
+  PlantParameters plant;
+  int thread_count = 1;
+
+  // Gains per lane
+  AlignedVector current_kp, current_ki, speed_kp, speed_ki;
+  // State per lane
+  AlignedVector angle, speed, i_d, i_q, speed_integral, d_integral, q_integral, electrical_angle;
+  // Score per lane
+  AlignedVector speed_error_ise, peak_current;
+
+  void runLanes(const Motor&, size_t begin, size_t end, float speed_reference, float duration, float dt);
+
+public:
+  void add(const ControllerGains&);
+  void clear();
+  size_t size() const;
+  void run(Motor&, float speed_reference, float duration, float dt);
+
+  // Set
+  void setLimits(ControllerLimits);
+  void setPlant(PlantParameters);
+  void setThreadCount(int);
+
+  // Get
+  ControllerGains getGains(size_t lane) const;
+  float getSpeedISE(size_t lane) const; // Integral of squared speed error
+  float getPeakCurrent(size_t lane) const;
+  float getFinalSpeed(size_t lane) const;
+  size_t getBestLane() const; // Lowest speed ISE
+};
@@ -19,6 +19,8 @@
 #include "Dipole.hpp"
 #include "World.hpp"
 #include "Controller.hpp"
+#include "Trace.hpp"
+#include "LoopTable.hpp"
 
 
 
@@ -26,55 +28,13 @@
 Dipole::Dipole(float offset, float height, float _orientation, float _current, float _radius, int res) : 
   current(_current), orientation(_orientation), radius(_radius)
 {
-  // Generate dipole
-  float d_theta = 2 * M_PI / res;
-
-  cv::Point3f start(offset, 0, 0);
-  cv::Point3f end(offset, _radius, 0);
-  cv::Mat start_mat = (cv::Mat_<float>(4, 1) << start.x, start.y, start.z, 1);
-  cv::Mat end_mat = (cv::Mat_<float>(4, 1) << end.x, end.y, end.z, 1);
-  cv::Mat dir_mat = (cv::Mat_<float>(4, 1) << 0, 0, 0, 0);
-
-  // Make coil transform
-  cv::Mat coil_transform(cv::Size(4, 4), CV_32FC1, cv::Scalar(0));
-    // Set rotation
-    coil_transform.at<float>(0, 0) = 1;
-    coil_transform.at<float>(1, 1) = cos(d_theta);
-    coil_transform.at<float>(2, 1) = sin(d_theta);
-    coil_transform.at<float>(1, 2) = -sin(d_theta);
-    coil_transform.at<float>(2, 2) = cos(d_theta);
-    // Scale
-    coil_transform.at<float>(3, 3) = 1;
-
-  // Make orientation transform
-  cv::Mat orientation_transform(cv::Size(4, 4), CV_32FC1, cv::Scalar(0));
-    // Set position change
-    orientation_transform.at<float>(2, 3) = height;
-    // Set rotation
-    orientation_transform.at<float>(0, 0) = cos(orientation);
-    orientation_transform.at<float>(0, 1) = -sin(orientation);
-    orientation_transform.at<float>(1, 0) = sin(orientation);
-    orientation_transform.at<float>(1, 1) = cos(orientation);
-    orientation_transform.at<float>(2, 2) = 1;
-    // Scale
-    orientation_transform.at<float>(3, 3) = 1;
-
-  for(int i = 0; i < res; i++){
-    FieldVector field_vector;
-    // Set start equals to end
-    end_mat.copyTo(start_mat);
-    // Rotate end
-    end_mat = coil_transform * end_mat;
-    // Set desired z-orientation
-    cv::Mat end_mat_rotated = orientation_transform * end_mat;
-    cv::Mat start_mat_rotated = orientation_transform * start_mat;
-    // Dir = end - start
-    dir_mat = end_mat_rotated - start_mat_rotated;
-    // Set field vector values
-    field_vector.pos = cv::Vec3d(start_mat_rotated.at<float>(0, 0), start_mat_rotated.at<float>(1, 0), start_mat_rotated.at<float>(2, 0));
-    field_vector.dir = cv::Vec3d(dir_mat.at<float>(0, 0), dir_mat.at<float>(1, 0), dir_mat.at<float>(2, 0));
-    dipole_wire_vectors.push_back(field_vector);
-  }
+  // Loop lies in the plane spanned by z and the radial direction, centered at offset along the radial direction
+  center = cv::Vec3d(offset * cos(orientation), offset * sin(orientation), height);
+  normal = cv::Vec3d(cos(orientation), sin(orientation), 0);
+
+  // Generate dipole: point k at angle k * 2pi / res about the x-axis, turned by the orientation about the z-axis and lifted to height
+  generateLoop(cv::Vec3d(offset, 0, 0), cv::Vec3d(0, 0, height), res);
+  TRACE_COUNT(TRACE_SEGMENTS_ALLOCATED, dipole_wire_vectors.size());
 }
 
 
@@ -82,6 +42,9 @@ Dipole::Dipole(float offset, float height, float _orientation, float _current, f
 Dipole::Dipole(cv::Point2f _pos, float _orientation, float _current, float _radius, float res) : 
   current(_current), orientation(_orientation), radius(_radius)
 {
+  center = cv::Vec3d(_pos.x, _pos.y, 0);
+  normal = cv::Vec3d(cos(orientation), sin(orientation), 0);
+
   /* 
     Idea of this constructor:
       Generate dipole at center(0, 0, 0)
@@ -89,83 +52,60 @@ Dipole::Dipole(cv::Point2f _pos, float _orientation, float _current, float _radi
       Move to given position
    */
 
-  // Generate dipole
-  float d_theta = 2 * M_PI / res;
-
-  cv::Point3f end(0, _radius, 0);
-  cv::Mat start_mat = (cv::Mat_<float>(4, 1) << 0, 0, 0);
-  cv::Mat end_mat = (cv::Mat_<float>(4, 1) << end.x, end.y, end.z, 1);
-  cv::Mat dir_mat = (cv::Mat_<float>(4, 1) << 0, 0, 0, 0);
-  cv::Mat offset_mat = (cv::Mat_<float>(4, 1) << _pos.x, _pos.y, 0, 0);
-
-  // Make coil transform
-  cv::Mat coil_transform(cv::Size(4, 4), CV_32FC1, cv::Scalar(0));
-    // Set rotation
-    coil_transform.at<float>(0, 0) = 1;
-    coil_transform.at<float>(1, 1) = cos(d_theta);
-    coil_transform.at<float>(2, 1) = sin(d_theta);
-    coil_transform.at<float>(1, 2) = -sin(d_theta);
-    coil_transform.at<float>(2, 2) = cos(d_theta);
-    // Scale
-    coil_transform.at<float>(3, 3) = 1;
-
-  // Make orientation transform
-  cv::Mat orientation_transform(cv::Size(4, 4), CV_32FC1, cv::Scalar(0));
-    // Set position change
-    orientation_transform.at<float>(2, 3) = 0;
-    // Set rotation
-    orientation_transform.at<float>(0, 0) = cos(orientation);
-    orientation_transform.at<float>(0, 1) = -sin(orientation);
-    orientation_transform.at<float>(1, 0) = sin(orientation);
-    orientation_transform.at<float>(1, 1) = cos(orientation);
-    orientation_transform.at<float>(2, 2) = 1;
-    // Scale
-    orientation_transform.at<float>(3, 3) = 1;
-
-  for(int i = 0; i < res; i++){
-    FieldVector field_vector;
-    // Set start equals to end
-    end_mat.copyTo(start_mat);
-    // Rotate end
-    end_mat = coil_transform * end_mat;
-    // Set desired z-orientation
-    cv::Mat end_mat_rotated = orientation_transform * end_mat;
-    cv::Mat start_mat_rotated = orientation_transform * start_mat;
-    // Offset transformation
-    end_mat_rotated = end_mat_rotated + offset_mat;
-    start_mat_rotated = start_mat_rotated + offset_mat;
-    // Dir = end - start
-    dir_mat = end_mat_rotated - start_mat_rotated;
-    // Set field vector values
-    field_vector.pos = cv::Vec3d(start_mat_rotated.at<float>(0, 0), start_mat_rotated.at<float>(1, 0), start_mat_rotated.at<float>(2, 0));
-    field_vector.dir = cv::Vec3d(dir_mat.at<float>(0, 0), dir_mat.at<float>(1, 0), dir_mat.at<float>(2, 0));
-    dipole_wire_vectors.push_back(field_vector);
-  }
+  generateLoop(cv::Vec3d(0, 0, 0), cv::Vec3d(_pos.x, _pos.y, 0), res);
+  TRACE_COUNT(TRACE_SEGMENTS_ALLOCATED, dipole_wire_vectors.size());
+}
+
+
+// Loop of radius about the x-axis through loop_center, turned by the orientation about the z-axis and moved by offset
+void Dipole::generateLoop(const cv::Vec3d& loop_center, const cv::Vec3d& offset, float res){
+  double cos_orientation = cos(orientation);
+  double sin_orientation = sin(orientation);
+  int segments = std::ceil(res);
+  dipole_wire_vectors.reserve(segments);
+  dipole_segments.reserve(segments);
+
+  dispatchLoopResolution(res, [&](const auto& loop){
+    for(int i = 0; i < segments; i++){
+      cv::Vec3d start = loop_center + cv::Vec3d(0, radius * loop.cos(i), radius * loop.sin(i));
+      cv::Vec3d end = loop_center + cv::Vec3d(0, radius * loop.cos(i + 1), radius * loop.sin(i + 1));
+
+      FieldVector field_vector;
+      field_vector.pos = rotateVector3D_z(start, cos_orientation, sin_orientation) + offset;
+      field_vector.dir = rotateVector3D_z(end - start, cos_orientation, sin_orientation);
+      dipole_wire_vectors.push_back(field_vector);
+      dipole_segments.push_back(field_vector);
+    }
+  });
+}
+
+
+cv::Vec3d Dipole::getFieldVectorAtPos(const cv::Vec3d& pos) const {
+  return current * loopFieldSum(dipole_segments, pos);
 }
 
 
-cv::Vec3d Dipole::getFieldVectorAtPos(cv::Vec3d pos){
-  cv::Vec3d d_field;
-  int coil_wire_vectors_size = dipole_wire_vectors.size();
-  for(int i = 0; i < coil_wire_vectors_size; i++){
-    FieldVector temp_field_vector = dipole_wire_vectors[i];
-    d_field += calcFieldStrength(temp_field_vector, pos);
+// Field of the ideal circular loop, switching to the point-dipole field in the far field
+cv::Vec3d Dipole::getLoopFieldVectorAtPos(const cv::Vec3d& pos) const {
+  cv::Vec3d r_vec = pos - center;
+  if(r_vec.dot(r_vec) > pow(dipoleFarFieldDistance(radius), 2)){
+    return pointDipoleField(center, getMoment(), pos);
   }
-  return d_field;
+  return currentLoopField(center, normal, radius, current, pos);
 }
 
 
-cv::Vec3d Dipole::calcFieldStrength(FieldVector vec, cv::Vec3d p){
-  float u0 = 1;
+cv::Vec3d Dipole::calcFieldStrength(const FieldVector& vec, const cv::Vec3d& p) const {
+  double u0 = 1;
   cv::Vec3d r_vec = p - vec.pos;
-  float r = cv::norm(r_vec);
+  double r = cv::norm(r_vec);
   cv::Vec3d r_hat = r_vec / r;
   cv::Vec3d ds = vec.dir;
   return (current * ds.cross(r_hat)) / (pow(r, 2));
 }
 
 
-cv::Vec3d Dipole::forceOnWireDL(FieldVector field_vector, float current){
+cv::Vec3d Dipole::forceOnWireDL(const FieldVector& field_vector, float current) const {
   // Calculates magnetic field set up at position of wire-dL from dipole
   cv::Vec3d d_field = getFieldVectorAtPos(field_vector.pos);
   
@@ -177,7 +117,113 @@ cv::Vec3d Dipole::forceOnWireDL(FieldVector field_vector, float current){
 
 
 // Get methods
-float Dipole::getCurrent(){
+float Dipole::getCurrent() const {
   return current;
 }
 
+
+size_t Dipole::getBytes() const {
+  return dipole_wire_vectors.capacity() * sizeof(FieldVector) + dipole_segments.getBytes();
+}
+
+
+float Dipole::getRadius() const {
+  return radius;
+}
+
+
+cv::Vec3d Dipole::getCenter() const {
+  return center;
+}
+
+
+cv::Vec3d Dipole::getNormal() const {
+  return normal;
+}
+
+
+// m = I * A * n
+cv::Vec3d Dipole::getMoment() const {
+  return current * M_PI * radius * radius * normal;
+}
+
+
+// Moment of the discretised loop, m = I/2 sum r x dL, which differs from the ideal circle for small res
+cv::Vec3d Dipole::getSegmentMoment() const {
+  cv::Vec3d area;
+  for(int i = 0; i < dipole_wire_vectors.size(); i++){
+    const FieldVector& v = dipole_wire_vectors[i];
+    area += 0.5 * (v.pos - center).cross(v.dir);
+  }
+  return current * area;
+}
+
+
+// Complete elliptic integrals K(m) and E(m) of parameter m = k^2, by the arithmetic-geometric mean
+static void ellipticKE(double m, double& K, double& E){
+  double a = 1;
+  double b = sqrt(1 - m);
+  double c_sum = m / 2;
+  double power = 0.5;
+
+  for(int i = 0; i < 16 && fabs(a - b) > 1e-15 * a; i++){
+    double c = (a - b) / 2;
+    double a_next = (a + b) / 2;
+    b = sqrt(a * b);
+    a = a_next;
+    power *= 2;
+    c_sum += power * c * c;
+  }
+
+  K = M_PI / (2 * a);
+  E = K * (1 - c_sum);
+}
+
+
+cv::Vec3d currentLoopField(const cv::Vec3d& center, const cv::Vec3d& normal, double radius, double current, const cv::Vec3d& pos){
+  /*
+    Field of a circular loop in cylindrical coordinates around its axis (Simpson et al.),
+    with u0 / 4pi = 1 to match the segment sum, so u0 * I / pi = 4 * I.
+   */
+  cv::Vec3d r_vec = pos - center;
+  double z = r_vec.dot(normal);
+  cv::Vec3d rho_vec = r_vec - z * normal;
+  double rho = cv::norm(rho_vec);
+
+  double a = radius;
+  double r2 = rho*rho + z*z;
+  double alpha2 = a*a + r2 - 2*a*rho;
+  double beta2 = a*a + r2 + 2*a*rho;
+  double beta = sqrt(beta2);
+  double m = 1 - alpha2 / beta2;
+
+  double K, E;
+  ellipticKE(m, K, E);
+
+  double C = 4 * current;
+  double B_z = C / (2 * alpha2 * beta) * ((a*a - r2) * E + alpha2 * K);
+  cv::Vec3d field = B_z * normal;
+
+  if(rho > 1e-12 * a){
+    double B_rho = C * z / (2 * alpha2 * beta * rho) * ((a*a + r2) * E - alpha2 * K);
+    field += B_rho * rho_vec / rho;
+  }
+  return field;
+}
+
+
+// B = (3 (m . r_hat) r_hat - m) / r^3, with u0 / 4pi = 1
+cv::Vec3d pointDipoleField(const cv::Vec3d& center, const cv::Vec3d& moment, const cv::Vec3d& pos){
+  cv::Vec3d r_vec = pos - center;
+  double r2 = r_vec.dot(r_vec);
+  double r = sqrt(r2);
+  cv::Vec3d r_hat = r_vec / r;
+  return (3 * moment.dot(r_hat) * r_hat - moment) / (r2 * r);
+}
+
+
+// Relative error of the point dipole is at most ~1.5 (R/r)^2 (largest on the axis), rounded up for margin
+double dipoleFarFieldDistance(double radius){
+  return radius * sqrt(1.6 / DIPOLE_FAR_FIELD_TOLERANCE);
+}
+
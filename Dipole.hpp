@@ -17,22 +17,44 @@
 
 // user headers
 #include "util.hpp"
+#include "WireSegments.hpp"
 
 
 
+// Beyond this many loop radii the point-dipole field is used, which bounds the relative error by DIPOLE_FAR_FIELD_TOLERANCE
+#define DIPOLE_FAR_FIELD_TOLERANCE 1e-3
+
+
 class Dipole {
   float current;
   float orientation;
   float radius;
+  cv::Vec3d center;
+  cv::Vec3d normal; // Unit normal, right-handed with the current
+  void generateLoop(const cv::Vec3d& loop_center, const cv::Vec3d& offset, float res);
 public:
   Dipole(float offset, float height, float orientation, float current, float radius, int res);
   Dipole(cv::Point2f pos, float orientation, float current, float radius, float res);
   std::vector<FieldVector> dipole_wire_vectors;
-  cv::Vec3d getFieldVectorAtPos(cv::Vec3d);
-  cv::Vec3d calcFieldStrength(FieldVector, cv::Vec3d);
-  cv::Vec3d forceOnWireDL(FieldVector, float);
+  WireSegments dipole_segments;
+  cv::Vec3d getFieldVectorAtPos(const cv::Vec3d&) const;
+  cv::Vec3d getLoopFieldVectorAtPos(const cv::Vec3d&) const;
+  cv::Vec3d calcFieldStrength(const FieldVector&, const cv::Vec3d&) const;
+  cv::Vec3d forceOnWireDL(const FieldVector&, float) const;
 
   // Get methods
-  float getCurrent();
+  float getCurrent() const;
+  size_t getBytes() const; // Heap bytes held
+  float getRadius() const;
+  cv::Vec3d getCenter() const;
+  cv::Vec3d getNormal() const;
+  cv::Vec3d getMoment() const;
+  cv::Vec3d getSegmentMoment() const;
 };
 
+
+// Closed form field of an ideal circular loop, and of a point dipole with moment m
+cv::Vec3d currentLoopField(const cv::Vec3d& center, const cv::Vec3d& normal, double radius, double current, const cv::Vec3d& pos);
+cv::Vec3d pointDipoleField(const cv::Vec3d& center, const cv::Vec3d& moment, const cv::Vec3d& pos);
+double dipoleFarFieldDistance(double radius);
+
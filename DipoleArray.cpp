@@ -0,0 +1,330 @@
+
+// stdlib
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iomanip>
+#include <immintrin.h>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// User headers
+#include "DipoleArray.hpp"
+#include "Trace.hpp"
+
+
+
+void DipoleArray::push_back(const Dipole& dipole){
+  cv::Vec3d c = dipole.getCenter();
+  cv::Vec3d n = dipole.getNormal();
+  center_x.push_back(c[0]);
+  center_y.push_back(c[1]);
+  center_z.push_back(c[2]);
+  normal_x.push_back(n[0]);
+  normal_y.push_back(n[1]);
+  normal_z.push_back(n[2]);
+  current.push_back(dipole.getCurrent());
+  radius.push_back(dipole.getRadius());
+}
+
+
+void DipoleArray::push_back(const cv::Vec3d& c, const cv::Vec3d& n, double _current, double _radius){
+  center_x.push_back(c[0]);
+  center_y.push_back(c[1]);
+  center_z.push_back(c[2]);
+  normal_x.push_back(n[0]);
+  normal_y.push_back(n[1]);
+  normal_z.push_back(n[2]);
+  current.push_back(_current);
+  radius.push_back(_radius);
+}
+
+
+void DipoleArray::push_back(const DipoleArray& dipoles, size_t i){
+  center_x.push_back(dipoles.center_x[i]);
+  center_y.push_back(dipoles.center_y[i]);
+  center_z.push_back(dipoles.center_z[i]);
+  normal_x.push_back(dipoles.normal_x[i]);
+  normal_y.push_back(dipoles.normal_y[i]);
+  normal_z.push_back(dipoles.normal_z[i]);
+  current.push_back(dipoles.current[i]);
+  radius.push_back(dipoles.radius[i]);
+}
+
+
+void DipoleArray::append(const DipoleArray& dipoles){
+  for(size_t i = 0; i < dipoles.size(); i++){
+    push_back(dipoles, i);
+  }
+}
+
+
+void DipoleArray::clear(){
+  center_x.clear();
+  center_y.clear();
+  center_z.clear();
+  normal_x.clear();
+  normal_y.clear();
+  normal_z.clear();
+  current.clear();
+  radius.clear();
+}
+
+
+size_t DipoleArray::size() const {
+  return center_x.size();
+}
+
+
+size_t DipoleArray::getBytes() const {
+  return 8 * center_x.capacity() * sizeof(double);
+}
+
+
+cv::Vec3d DipoleArray::getFieldVectorAtPos(const cv::Vec3d& p) const {
+  return getFieldVectorAtPos(p, 0, size());
+}
+
+
+cv::Vec3d DipoleArray::getFieldVectorAtPos(const cv::Vec3d& p, size_t begin, size_t end) const {
+  TRACE_COUNT(TRACE_INTERACTIONS, end - begin);
+  // Point dipole field B = (3 (m . r) r / r^2 - m) / r^3 with m = I pi R^2 n, exact loop field when near
+  double bx = 0, by = 0, bz = 0;
+  double far_ratio2 = pow(dipoleFarFieldDistance(1), 2);
+
+  for(size_t i = begin; i < end; i++){
+    double rx = p[0] - center_x[i];
+    double ry = p[1] - center_y[i];
+    double rz = p[2] - center_z[i];
+    double r2 = rx*rx + ry*ry + rz*rz;
+
+    if(r2 <= far_ratio2 * radius[i] * radius[i]){
+      cv::Vec3d c(center_x[i], center_y[i], center_z[i]);
+      cv::Vec3d normal(normal_x[i], normal_y[i], normal_z[i]);
+      cv::Vec3d near_field = currentLoopField(c, normal, radius[i], current[i], p);
+      bx += near_field[0];
+      by += near_field[1];
+      bz += near_field[2];
+      continue;
+    }
+
+    double m = current[i] * M_PI * radius[i] * radius[i];
+    double mx = m * normal_x[i];
+    double my = m * normal_y[i];
+    double mz = m * normal_z[i];
+    double inv_r2 = 1.0 / r2;
+    double inv_r3 = inv_r2 * sqrt(inv_r2);
+    double m_dot_r = 3 * (mx*rx + my*ry + mz*rz) * inv_r2;
+
+    bx += (m_dot_r * rx - mx) * inv_r3;
+    by += (m_dot_r * ry - my) * inv_r3;
+    bz += (m_dot_r * rz - mz) * inv_r3;
+  }
+
+  return cv::Vec3d(bx, by, bz);
+}
+
+
+
+FieldVector DipoleArray::getInstanceSegment(const WireSegments& prototype, size_t i, size_t k) const {
+  cv::Vec3d pos(prototype.pos_x[k], prototype.pos_y[k], prototype.pos_z[k]);
+  cv::Vec3d dir(prototype.dir_x[k], prototype.dir_y[k], prototype.dir_z[k]);
+
+  FieldVector field_vector;
+  field_vector.pos = rotateVector3D_z(pos, normal_x[i], normal_y[i]) + cv::Vec3d(center_x[i], center_y[i], center_z[i]);
+  field_vector.dir = rotateVector3D_z(dir, normal_x[i], normal_y[i]);
+  return field_vector;
+}
+
+
+/*
+  The query is moved into each dipole's frame, q = R^T (p - c) with R the turn about z onto the normal,
+  the prototype is summed there and the result is turned back and scaled: B += I R B_prototype(q).
+  The SIMD versions handle one dipole per lane, with the prototype segments broadcast.
+ */
+static cv::Vec3d instancedFieldScalar(const DipoleArray& d, const WireSegments& s, const cv::Vec3d& p, size_t begin, size_t end){
+  double bx = 0, by = 0, bz = 0;
+  size_t res = s.size();
+
+  for(size_t i = begin; i < end; i++){
+    double c = d.normal_x[i];
+    double sn = d.normal_y[i];
+    double dx = p[0] - d.center_x[i];
+    double dy = p[1] - d.center_y[i];
+    double qx = c*dx + sn*dy;
+    double qy = c*dy - sn*dx;
+    double qz = p[2] - d.center_z[i];
+
+    double lx = 0, ly = 0, lz = 0;
+    for(size_t k = 0; k < res; k++){
+      double rx = qx - s.pos_x[k];
+      double ry = qy - s.pos_y[k];
+      double rz = qz - s.pos_z[k];
+      double r2 = rx*rx + ry*ry + rz*rz;
+      double inv_r3 = 1.0 / (r2 * sqrt(r2));
+
+      lx += (s.dir_y[k]*rz - s.dir_z[k]*ry) * inv_r3;
+      ly += (s.dir_z[k]*rx - s.dir_x[k]*rz) * inv_r3;
+      lz += (s.dir_x[k]*ry - s.dir_y[k]*rx) * inv_r3;
+    }
+
+    double current = d.current[i];
+    bx += current * (c*lx - sn*ly);
+    by += current * (sn*lx + c*ly);
+    bz += current * lz;
+  }
+
+  return cv::Vec3d(bx, by, bz);
+}
+
+
+__attribute__((target("avx2,fma")))
+static cv::Vec3d instancedFieldAVX2(const DipoleArray& d, const WireSegments& s, const cv::Vec3d& p, size_t begin, size_t end){
+  const size_t lanes = 4;
+  size_t n = end - (end - begin) % lanes;
+  size_t res = s.size();
+
+  __m256d px = _mm256_set1_pd(p[0]);
+  __m256d py = _mm256_set1_pd(p[1]);
+  __m256d pz = _mm256_set1_pd(p[2]);
+  __m256d one = _mm256_set1_pd(1.0);
+  __m256d bx = _mm256_setzero_pd();
+  __m256d by = _mm256_setzero_pd();
+  __m256d bz = _mm256_setzero_pd();
+
+  for(size_t i = begin; i < n; i += lanes){
+    __m256d c = _mm256_loadu_pd(&d.normal_x[i]);
+    __m256d sn = _mm256_loadu_pd(&d.normal_y[i]);
+    __m256d dx = _mm256_sub_pd(px, _mm256_loadu_pd(&d.center_x[i]));
+    __m256d dy = _mm256_sub_pd(py, _mm256_loadu_pd(&d.center_y[i]));
+    __m256d qx = _mm256_fmadd_pd(c, dx, _mm256_mul_pd(sn, dy));
+    __m256d qy = _mm256_fmsub_pd(c, dy, _mm256_mul_pd(sn, dx));
+    __m256d qz = _mm256_sub_pd(pz, _mm256_loadu_pd(&d.center_z[i]));
+
+    __m256d lx = _mm256_setzero_pd();
+    __m256d ly = _mm256_setzero_pd();
+    __m256d lz = _mm256_setzero_pd();
+    for(size_t k = 0; k < res; k++){
+      __m256d rx = _mm256_sub_pd(qx, _mm256_set1_pd(s.pos_x[k]));
+      __m256d ry = _mm256_sub_pd(qy, _mm256_set1_pd(s.pos_y[k]));
+      __m256d rz = _mm256_sub_pd(qz, _mm256_set1_pd(s.pos_z[k]));
+      __m256d sx = _mm256_set1_pd(s.dir_x[k]);
+      __m256d sy = _mm256_set1_pd(s.dir_y[k]);
+      __m256d sz = _mm256_set1_pd(s.dir_z[k]);
+
+      __m256d r2 = _mm256_fmadd_pd(rx, rx, _mm256_fmadd_pd(ry, ry, _mm256_mul_pd(rz, rz)));
+      __m256d inv_r3 = _mm256_div_pd(one, _mm256_mul_pd(r2, _mm256_sqrt_pd(r2)));
+
+      lx = _mm256_fmadd_pd(_mm256_fmsub_pd(sy, rz, _mm256_mul_pd(sz, ry)), inv_r3, lx);
+      ly = _mm256_fmadd_pd(_mm256_fmsub_pd(sz, rx, _mm256_mul_pd(sx, rz)), inv_r3, ly);
+      lz = _mm256_fmadd_pd(_mm256_fmsub_pd(sx, ry, _mm256_mul_pd(sy, rx)), inv_r3, lz);
+    }
+
+    __m256d current = _mm256_loadu_pd(&d.current[i]);
+    bx = _mm256_fmadd_pd(current, _mm256_fmsub_pd(c, lx, _mm256_mul_pd(sn, ly)), bx);
+    by = _mm256_fmadd_pd(current, _mm256_fmadd_pd(sn, lx, _mm256_mul_pd(c, ly)), by);
+    bz = _mm256_fmadd_pd(current, lz, bz);
+  }
+
+  alignas(32) double sum_x[lanes], sum_y[lanes], sum_z[lanes];
+  _mm256_store_pd(sum_x, bx);
+  _mm256_store_pd(sum_y, by);
+  _mm256_store_pd(sum_z, bz);
+
+  cv::Vec3d field = instancedFieldScalar(d, s, p, n, end);
+  for(size_t k = 0; k < lanes; k++){
+    field += cv::Vec3d(sum_x[k], sum_y[k], sum_z[k]);
+  }
+  return field;
+}
+
+
+__attribute__((target("avx512f")))
+static cv::Vec3d instancedFieldAVX512(const DipoleArray& d, const WireSegments& s, const cv::Vec3d& p, size_t begin, size_t end){
+  const size_t lanes = 8;
+  size_t n = end - (end - begin) % lanes;
+  size_t res = s.size();
+
+  __m512d px = _mm512_set1_pd(p[0]);
+  __m512d py = _mm512_set1_pd(p[1]);
+  __m512d pz = _mm512_set1_pd(p[2]);
+  __m512d one = _mm512_set1_pd(1.0);
+  __m512d bx = _mm512_setzero_pd();
+  __m512d by = _mm512_setzero_pd();
+  __m512d bz = _mm512_setzero_pd();
+
+  for(size_t i = begin; i < n; i += lanes){
+    __m512d c = _mm512_loadu_pd(&d.normal_x[i]);
+    __m512d sn = _mm512_loadu_pd(&d.normal_y[i]);
+    __m512d dx = _mm512_sub_pd(px, _mm512_loadu_pd(&d.center_x[i]));
+    __m512d dy = _mm512_sub_pd(py, _mm512_loadu_pd(&d.center_y[i]));
+    __m512d qx = _mm512_fmadd_pd(c, dx, _mm512_mul_pd(sn, dy));
+    __m512d qy = _mm512_fmsub_pd(c, dy, _mm512_mul_pd(sn, dx));
+    __m512d qz = _mm512_sub_pd(pz, _mm512_loadu_pd(&d.center_z[i]));
+
+    __m512d lx = _mm512_setzero_pd();
+    __m512d ly = _mm512_setzero_pd();
+    __m512d lz = _mm512_setzero_pd();
+    for(size_t k = 0; k < res; k++){
+      __m512d rx = _mm512_sub_pd(qx, _mm512_set1_pd(s.pos_x[k]));
+      __m512d ry = _mm512_sub_pd(qy, _mm512_set1_pd(s.pos_y[k]));
+      __m512d rz = _mm512_sub_pd(qz, _mm512_set1_pd(s.pos_z[k]));
+      __m512d sx = _mm512_set1_pd(s.dir_x[k]);
+      __m512d sy = _mm512_set1_pd(s.dir_y[k]);
+      __m512d sz = _mm512_set1_pd(s.dir_z[k]);
+
+      __m512d r2 = _mm512_fmadd_pd(rx, rx, _mm512_fmadd_pd(ry, ry, _mm512_mul_pd(rz, rz)));
+      __m512d inv_r3 = _mm512_div_pd(one, _mm512_mul_pd(r2, _mm512_sqrt_pd(r2)));
+
+      lx = _mm512_fmadd_pd(_mm512_fmsub_pd(sy, rz, _mm512_mul_pd(sz, ry)), inv_r3, lx);
+      ly = _mm512_fmadd_pd(_mm512_fmsub_pd(sz, rx, _mm512_mul_pd(sx, rz)), inv_r3, ly);
+      lz = _mm512_fmadd_pd(_mm512_fmsub_pd(sx, ry, _mm512_mul_pd(sy, rx)), inv_r3, lz);
+    }
+
+    __m512d current = _mm512_loadu_pd(&d.current[i]);
+    bx = _mm512_fmadd_pd(current, _mm512_fmsub_pd(c, lx, _mm512_mul_pd(sn, ly)), bx);
+    by = _mm512_fmadd_pd(current, _mm512_fmadd_pd(sn, lx, _mm512_mul_pd(c, ly)), by);
+    bz = _mm512_fmadd_pd(current, lz, bz);
+  }
+
+  cv::Vec3d field = instancedFieldScalar(d, s, p, n, end);
+  field += cv::Vec3d(_mm512_reduce_add_pd(bx), _mm512_reduce_add_pd(by), _mm512_reduce_add_pd(bz));
+  return field;
+}
+
+
+typedef cv::Vec3d (*InstancedFieldKernel)(const DipoleArray&, const WireSegments&, const cv::Vec3d&, size_t begin, size_t end);
+
+static cv::Vec3d instancedFieldFallback(const DipoleArray& d, const WireSegments& s, const cv::Vec3d& p, size_t begin, size_t end){
+  return instancedFieldScalar(d, s, p, begin, end);
+}
+
+static InstancedFieldKernel selectInstancedFieldKernel(){
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f")){
+    return instancedFieldAVX512;
+  }
+  if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")){
+    return instancedFieldAVX2;
+  }
+  return instancedFieldFallback;
+}
+
+
+cv::Vec3d DipoleArray::getInstancedFieldVectorAtPos(const WireSegments& prototype, const cv::Vec3d& p) const {
+  return getInstancedFieldVectorAtPos(prototype, p, 0, size());
+}
+
+
+cv::Vec3d DipoleArray::getInstancedFieldVectorAtPos(const WireSegments& prototype, const cv::Vec3d& p, size_t begin, size_t end) const {
+  TRACE_COUNT(TRACE_INTERACTIONS, (end - begin) * prototype.size());
+  static const InstancedFieldKernel kernel = selectInstancedFieldKernel();
+  return kernel(*this, prototype, p, begin, end);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+// stdlib
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iomanip>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// user headers
+#include "util.hpp"
+#include "WireSegments.hpp"
+#include "Dipole.hpp"
+
+
+
+/*
+  Structure-of-arrays storage of ideal current loops for the closed form dipole field.
+  Loops beyond dipoleFarFieldDistance are summed as point dipoles, the rest with the elliptic integral form.
+ */
+class DipoleArray {
+public:
+  AlignedVector center_x, center_y, center_z;
+  AlignedVector normal_x, normal_y, normal_z;
+  AlignedVector current;
+  AlignedVector radius;
+
+  void push_back(const Dipole&);
+  void push_back(const cv::Vec3d& center, const cv::Vec3d& normal, double current, double radius);
+  void push_back(const DipoleArray&, size_t i);
+  void append(const DipoleArray&);
+  void clear();
+  size_t size() const;
+  size_t getBytes() const; // Heap bytes held
+
+  cv::Vec3d getFieldVectorAtPos(const cv::Vec3d&) const;
+  cv::Vec3d getFieldVectorAtPos(const cv::Vec3d&, size_t begin, size_t end) const;
+
+  /*
+    Instanced wire loops: the prototype is one loop at unit current with its normal along x, centered at the origin.
+    Each dipole places it at its center, turned about z onto its normal, and scales it by its current.
+    Only the dipoles' center, normal and current are used, and normals have to lie in the xy-plane.
+   */
+  cv::Vec3d getInstancedFieldVectorAtPos(const WireSegments& prototype, const cv::Vec3d&) const;
+  cv::Vec3d getInstancedFieldVectorAtPos(const WireSegments& prototype, const cv::Vec3d&, size_t begin, size_t end) const;
+  FieldVector getInstanceSegment(const WireSegments& prototype, size_t i, size_t k) const; // Segment k of dipole i, unscaled
+};
@@ -0,0 +1,234 @@
+
+// stdlib
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iomanip>
+#include <algorithm>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// User headers
+#include "DipoleTree.hpp"
+
+
+
+void DipoleTree::build(const std::vector<const DipoleArray*>& dipole_arrays, const WireSegments* _prototype){
+  clear();
+
+  // Area and extent of the prototype, 1/2 |sum of p x dl| and the farthest point
+  if(_prototype){
+    prototype = *_prototype;
+    cv::Vec3d area(0, 0, 0);
+    loop_radius = 0;
+    for(size_t k = 0; k < prototype.size(); k++){
+      cv::Vec3d pos(prototype.pos_x[k], prototype.pos_y[k], prototype.pos_z[k]);
+      area += 0.5 * pos.cross(cv::Vec3d(prototype.dir_x[k], prototype.dir_y[k], prototype.dir_z[k]));
+      loop_radius = std::max(loop_radius, sqrt(pos.dot(pos)));
+    }
+    loop_area = sqrt(area.dot(area));
+  }
+
+  DipoleArray dipoles;
+  for(int a = 0; a < dipole_arrays.size(); a++){
+    dipoles.append(*dipole_arrays[a]);
+  }
+  if(dipoles.size() == 0){
+    return;
+  }
+
+  // Bounding cube
+  cv::Vec3d lo(dipoles.center_x[0], dipoles.center_y[0], dipoles.center_z[0]);
+  cv::Vec3d hi = lo;
+  for(size_t i = 0; i < dipoles.size(); i++){
+    cv::Vec3d c(dipoles.center_x[i], dipoles.center_y[i], dipoles.center_z[i]);
+    for(int k = 0; k < 3; k++){
+      lo[k] = std::min(lo[k], c[k]);
+      hi[k] = std::max(hi[k], c[k]);
+    }
+  }
+  double half_size = std::max(std::max(hi[0] - lo[0], hi[1] - lo[1]), hi[2] - lo[2]) / 2 + 1e-6;
+
+  std::vector<int> index(dipoles.size());
+  for(int i = 0; i < index.size(); i++){
+    index[i] = i;
+  }
+  build(index, dipoles, 0, index.size(), (lo + hi) / 2, half_size, 0);
+
+  for(int i = 0; i < index.size(); i++){
+    sources.push_back(dipoles, index[i]);
+  }
+}
+
+
+int DipoleTree::build(std::vector<int>& index, const DipoleArray& dipoles, int begin, int end, cv::Vec3d center, double half_size, int depth){
+  int node_num = nodes.size();
+  nodes.push_back(Node());
+
+  // Moment and expansion center, weighted by |m| so coincident opposite dipoles do not move the center
+  cv::Vec3d moment;
+  cv::Vec3d weighted_center;
+  double weight = 0;
+  double max_radius = 0;
+  for(int k = begin; k < end; k++){
+    int i = index[k];
+    max_radius = std::max(max_radius, loop_radius * dipoles.radius[i]);
+    double m = dipoles.current[i] * loop_area * dipoles.radius[i] * dipoles.radius[i];
+    moment += m * cv::Vec3d(dipoles.normal_x[i], dipoles.normal_y[i], dipoles.normal_z[i]);
+    weighted_center += fabs(m) * cv::Vec3d(dipoles.center_x[i], dipoles.center_y[i], dipoles.center_z[i]);
+    weight += fabs(m);
+  }
+  cv::Vec3d expansion_center = (weight > 0) ? weighted_center / weight : center;
+
+  double spread[9] = {0};
+  for(int k = begin; k < end; k++){
+    int i = index[k];
+    double m = dipoles.current[i] * loop_area * dipoles.radius[i] * dipoles.radius[i];
+    cv::Vec3d m_vec = m * cv::Vec3d(dipoles.normal_x[i], dipoles.normal_y[i], dipoles.normal_z[i]);
+    cv::Vec3d d = cv::Vec3d(dipoles.center_x[i], dipoles.center_y[i], dipoles.center_z[i]) - expansion_center;
+    for(int a = 0; a < 3; a++){
+      for(int b = 0; b < 3; b++){
+        spread[3*a + b] += m_vec[a] * d[b];
+      }
+    }
+  }
+
+  Node& node = nodes[node_num];
+  node.center = expansion_center;
+  node.size = 2 * half_size;
+  node.max_radius = max_radius;
+  node.moment = moment;
+  std::copy(spread, spread + 9, node.spread);
+  node.begin = begin;
+  node.end = end;
+
+  // Stop at small leaves, and at depth 20 so coincident dipoles cannot recurse forever
+  if(end - begin <= DIPOLE_TREE_LEAF_SIZE || depth >= 20){
+    return node_num;
+  }
+
+  // Partition into octants
+  std::vector<int> octant_index[8];
+  for(int k = begin; k < end; k++){
+    int i = index[k];
+    int octant = (dipoles.center_x[i] >= center[0]) | ((dipoles.center_y[i] >= center[1]) << 1) | ((dipoles.center_z[i] >= center[2]) << 2);
+    octant_index[octant].push_back(i);
+  }
+
+  int child_begin = begin;
+  int children[8];
+  for(int octant = 0; octant < 8; octant++){
+    std::copy(octant_index[octant].begin(), octant_index[octant].end(), index.begin() + child_begin);
+    int child_end = child_begin + octant_index[octant].size();
+    children[octant] = -1;
+
+    if(child_end > child_begin){
+      cv::Vec3d child_center = center + cv::Vec3d(
+        (octant & 1) ? half_size / 2 : -half_size / 2,
+        (octant & 2) ? half_size / 2 : -half_size / 2,
+        (octant & 4) ? half_size / 2 : -half_size / 2
+      );
+      children[octant] = build(index, dipoles, child_begin, child_end, child_center, half_size / 2, depth + 1);
+    }
+    child_begin = child_end;
+  }
+
+  // nodes may have been reallocated by the recursion
+  nodes[node_num].leaf = false;
+  std::copy(children, children + 8, nodes[node_num].child);
+  return node_num;
+}
+
+
+void DipoleTree::clear(){
+  nodes.clear();
+  sources.clear();
+  prototype.clear();
+  loop_area = M_PI;
+  loop_radius = 1;
+}
+
+
+bool DipoleTree::isBuilt() const {
+  return !nodes.empty();
+}
+
+
+size_t DipoleTree::size() const {
+  return sources.size();
+}
+
+
+size_t DipoleTree::getBytes() const {
+  return nodes.capacity() * sizeof(Node) + sources.getBytes() + prototype.getBytes();
+}
+
+
+void DipoleTree::setOpeningAngle(float _opening_angle){
+  opening_angle = _opening_angle;
+}
+
+
+float DipoleTree::getOpeningAngle() const {
+  return opening_angle;
+}
+
+
+cv::Vec3d DipoleTree::getFieldVectorAtPos(const cv::Vec3d& pos) const {
+  cv::Vec3d field;
+  if(nodes.empty()){
+    return field;
+  }
+
+  int stack[8 * 21 + 1];
+  int stack_size = 0;
+  stack[stack_size++] = 0;
+
+  while(stack_size > 0){
+    const Node& node = nodes[stack[--stack_size]];
+    cv::Vec3d r = pos - node.center;
+    double r2 = r.dot(r);
+
+    // Every dipole in the node must also be far enough away to be a point dipole
+    double far_distance = dipoleFarFieldDistance(node.max_radius) + node.size;
+    if(node.size * node.size < opening_angle * opening_angle * r2 && r2 > far_distance * far_distance){
+      /*
+        Dipole field of M at c, minus sum_j T_ij d/dr_j B[e_i](r) for the offset of each dipole from c:
+        dB = -(3 tr(T) r + 3 T^T r + 3 T r - 15 (r^T T r) r / r^2) / r^5
+       */
+      const double* T = node.spread;
+      cv::Vec3d T_r(T[0]*r[0] + T[1]*r[1] + T[2]*r[2], T[3]*r[0] + T[4]*r[1] + T[5]*r[2], T[6]*r[0] + T[7]*r[1] + T[8]*r[2]);
+      cv::Vec3d Tt_r(T[0]*r[0] + T[3]*r[1] + T[6]*r[2], T[1]*r[0] + T[4]*r[1] + T[7]*r[2], T[2]*r[0] + T[5]*r[1] + T[8]*r[2]);
+      double trace = T[0] + T[4] + T[8];
+      double r_T_r = r.dot(T_r);
+      double r5 = r2 * r2 * sqrt(r2);
+
+      field += pointDipoleField(node.center, node.moment, pos);
+      field -= (3 * trace * r + 3 * Tt_r + 3 * T_r - 15 * r_T_r / r2 * r) / r5;
+      continue;
+    }
+
+    if(node.leaf){
+      if(prototype.size() > 0){
+        field += sources.getInstancedFieldVectorAtPos(prototype, pos, node.begin, node.end);
+      }else{
+        field += sources.getFieldVectorAtPos(pos, node.begin, node.end);
+      }
+      continue;
+    }
+
+    for(int octant = 0; octant < 8; octant++){
+      if(node.child[octant] >= 0){
+        stack[stack_size++] = node.child[octant];
+      }
+    }
+  }
+  return field;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+// stdlib
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iomanip>
+#include <vector>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// user headers
+#include "util.hpp"
+#include "DipoleArray.hpp"
+
+
+// Maximum number of dipoles in a leaf
+#define DIPOLE_TREE_LEAF_SIZE 8
+
+
+/*
+  Barnes-Hut octree over dipole sources.
+  Every node stores the summed moment M of its dipoles about its center c, and the tensor T = sum m (x - c)^T,
+  so an accepted node contributes the dipole field of M plus the first correction for the spread of its dipoles.
+  A node is accepted when its size over the distance to the query point is below the opening angle.
+  Built with a prototype loop, the dipoles are instances of it as in DipoleArray::getInstancedFieldVectorAtPos:
+  leaves sum the prototype segments and moments use the prototype's area instead of the ideal circle's.
+ */
+class DipoleTree {
+  struct Node {
+    cv::Vec3d center;
+    double size = 0;
+    double max_radius = 0;
+    cv::Vec3d moment;
+    double spread[9] = {0}; // T, row major
+    int child[8] = {-1, -1, -1, -1, -1, -1, -1, -1};
+    int begin = 0;
+    int end = 0;
+    bool leaf = true;
+  };
+
+  std::vector<Node> nodes;
+  DipoleArray sources; // In tree order, each node owns sources [begin, end)
+  WireSegments prototype; // Empty for ideal loops
+  double loop_area = M_PI; // Per unit radius squared
+  double loop_radius = 1; // Per unit radius
+  float opening_angle = 0.2;
+
+  int build(std::vector<int>& index, const DipoleArray& dipoles, int begin, int end, cv::Vec3d center, double half_size, int depth);
+
+public:
+  void build(const std::vector<const DipoleArray*>& dipole_arrays, const WireSegments* prototype = nullptr);
+  void clear();
+  bool isBuilt() const;
+  size_t size() const;
+  size_t getBytes() const; // Heap bytes held
+
+  void setOpeningAngle(float);
+  float getOpeningAngle() const;
+  cv::Vec3d getFieldVectorAtPos(const cv::Vec3d&) const;
+};
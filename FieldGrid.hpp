@@ -0,0 +1,101 @@
+#pragma once
+
+// stdlib
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// user headers
+#include "util.hpp"
+#include "WireSegments.hpp"
+
+
+// Scalar type of the World's field grids
+#ifndef FIELD_GRID_SCALAR
+#define FIELD_GRID_SCALAR float
+#endif
+
+
+
+/*
+  Contiguous height x width grid of 3-component vectors, interleaved xyz, in one aligned allocation.
+  Rows start on row_alignment byte boundaries, so the stride can be larger than 3 * width.
+  resize() keeps the allocation when the shape is unchanged, and getMat() wraps the data in a cv::Mat without copying.
+ */
+template <typename T> class FieldGrid {
+  std::vector<T, AlignedAllocator<T>> values;
+  int width = 0;
+  int height = 0;
+  size_t stride = 0; // Elements between row starts
+
+public:
+  typedef cv::Vec<T, 3> Vec;
+
+  FieldGrid(){}
+
+  FieldGrid(int _width, int _height, size_t row_alignment = SEGMENT_ALIGNMENT){
+    resize(_width, _height, row_alignment);
+  }
+
+  // Grid is zeroed on any shape change, otherwise contents are kept
+  void resize(int _width, int _height, size_t row_alignment = SEGMENT_ALIGNMENT){
+    size_t row_bytes = (3 * _width * sizeof(T) + row_alignment - 1) / row_alignment * row_alignment;
+    size_t _stride = row_bytes / sizeof(T);
+    if(_width == width && _height == height && _stride == stride){
+      return;
+    }
+    width = _width;
+    height = _height;
+    stride = _stride;
+    values.assign(stride * height, T(0));
+  }
+
+  void setZero(){
+    std::fill(values.begin(), values.end(), T(0));
+  }
+
+  int getWidth() const { return width; }
+  int getHeight() const { return height; }
+  size_t getStride() const { return stride; }
+  size_t getBytes() const { return values.size() * sizeof(T); }
+  bool empty() const { return values.empty(); }
+
+  T* row(int y){ return values.data() + y * stride; }
+  const T* row(int y) const { return values.data() + y * stride; }
+
+  Vec& at(int y, int x){ return *(Vec*)(row(y) + 3 * x); }
+  const Vec& at(int y, int x) const { return *(const Vec*)(row(y) + 3 * x); }
+
+  cv::Vec3d get(int y, int x) const {
+    const T* v = row(y) + 3 * x;
+    return cv::Vec3d(v[0], v[1], v[2]);
+  }
+
+  void set(int y, int x, const cv::Vec3d& vec){
+    T* v = row(y) + 3 * x;
+    v[0] = vec[0];
+    v[1] = vec[1];
+    v[2] = vec[2];
+  }
+
+  // Header over the grid's own data, valid until the next shape change
+  cv::Mat getMat(){
+    return cv::Mat(height, width, CV_MAKETYPE(cv::DataType<T>::depth, 3), values.data(), stride * sizeof(T));
+  }
+
+  const cv::Mat getMat() const {
+    return cv::Mat(height, width, CV_MAKETYPE(cv::DataType<T>::depth, 3), (void*)values.data(), stride * sizeof(T));
+  }
+};
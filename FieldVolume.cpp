@@ -0,0 +1,209 @@
+
+// stdlib
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iomanip>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// User headers
+#include "FieldVolume.hpp"
+
+#define VOLUME_MAGIC "MVOL"
+#define VOLUME_VERSION 1
+#define VOLUME_HEADER_SIZE 64
+
+
+
+FieldVolume::FieldVolume(){}
+
+
+FieldVolume::~FieldVolume(){
+  close();
+}
+
+
+size_t FieldVolume::slabOffset(int z) const {
+  return VOLUME_HEADER_SIZE + size_t(z) * nx * ny * 3 * sizeof(float);
+}
+
+
+bool FieldVolume::create(const std::string& path, int _nx, int _ny, int _nz, cv::Vec3d _origin, double _spacing){
+  close();
+  nx = _nx;
+  ny = _ny;
+  nz = _nz;
+  origin = _origin;
+  spacing = _spacing;
+
+  fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0){
+    std::cout << "Could not open " << path << std::endl;
+    return false;
+  }
+
+  // Sparse until slabs are written
+  file_size = slabOffset(nz);
+  if(ftruncate(fd, file_size) != 0){
+    std::cout << "Could not size " << path << std::endl;
+    close();
+    return false;
+  }
+
+  unsigned char header[VOLUME_HEADER_SIZE] = {0};
+  uint32_t dims[4] = {VOLUME_VERSION, uint32_t(nx), uint32_t(ny), uint32_t(nz)};
+  double geometry[4] = {origin[0], origin[1], origin[2], spacing};
+  memcpy(header, VOLUME_MAGIC, 4);
+  memcpy(header + 4, dims, sizeof(dims));
+  memcpy(header + 20, geometry, sizeof(geometry));
+  if(pwrite(fd, header, VOLUME_HEADER_SIZE, 0) != VOLUME_HEADER_SIZE){
+    std::cout << "Could not write " << path << std::endl;
+    close();
+    return false;
+  }
+
+  writable = true;
+  return true;
+}
+
+
+bool FieldVolume::open(const std::string& path){
+  close();
+
+  fd = ::open(path.c_str(), O_RDONLY);
+  if(fd < 0){
+    std::cout << "Could not open " << path << std::endl;
+    return false;
+  }
+  struct stat file_stat;
+  fstat(fd, &file_stat);
+  file_size = file_stat.st_size;
+
+  unsigned char header[VOLUME_HEADER_SIZE];
+  if(file_size < VOLUME_HEADER_SIZE || pread(fd, header, VOLUME_HEADER_SIZE, 0) != VOLUME_HEADER_SIZE || memcmp(header, VOLUME_MAGIC, 4) != 0){
+    std::cout << "Not a field volume " << path << std::endl;
+    close();
+    return false;
+  }
+
+  uint32_t dims[4];
+  double geometry[4];
+  memcpy(dims, header + 4, sizeof(dims));
+  memcpy(geometry, header + 20, sizeof(geometry));
+  nx = dims[1];
+  ny = dims[2];
+  nz = dims[3];
+  origin = cv::Vec3d(geometry[0], geometry[1], geometry[2]);
+  spacing = geometry[3];
+
+  if(file_size < slabOffset(nz)){
+    std::cout << "Truncated field volume " << path << std::endl;
+    close();
+    return false;
+  }
+
+  void* map = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+  if(map == MAP_FAILED){
+    std::cout << "Could not map " << path << std::endl;
+    close();
+    return false;
+  }
+  mapped = (const unsigned char*)map;
+  return true;
+}
+
+
+void FieldVolume::close(){
+  if(mapped){
+    munmap((void*)mapped, file_size);
+    mapped = nullptr;
+  }
+  if(fd >= 0){
+    ::close(fd);
+    fd = -1;
+  }
+  writable = false;
+  file_size = 0;
+}
+
+
+bool FieldVolume::writeSlab(int z, const float* values){
+  if(!writable || z < 0 || z >= nz){
+    return false;
+  }
+
+  // Mappings have to start on a page boundary
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t offset = slabOffset(z);
+  size_t map_offset = offset / page * page;
+  size_t slab_bytes = size_t(nx) * ny * 3 * sizeof(float);
+  size_t map_bytes = offset - map_offset + slab_bytes;
+
+  void* map = mmap(nullptr, map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, map_offset);
+  if(map == MAP_FAILED){
+    return false;
+  }
+  memcpy((unsigned char*)map + (offset - map_offset), values, slab_bytes);
+  munmap(map, map_bytes);
+  return true;
+}
+
+
+const float* FieldVolume::getSlab(int z) const {
+  return (const float*)(mapped + slabOffset(z));
+}
+
+
+cv::Mat FieldVolume::getSlabMat(int z) const {
+  return cv::Mat(ny, nx, CV_32FC3, (void*)getSlab(z));
+}
+
+
+cv::Vec3d FieldVolume::get(int x, int y, int z) const {
+  const float* v = getSlab(z) + (size_t(y) * nx + x) * 3;
+  return cv::Vec3d(v[0], v[1], v[2]);
+}
+
+
+int FieldVolume::getSizeX() const {
+  return nx;
+}
+
+
+int FieldVolume::getSizeY() const {
+  return ny;
+}
+
+
+int FieldVolume::getSizeZ() const {
+  return nz;
+}
+
+
+cv::Vec3d FieldVolume::getOrigin() const {
+  return origin;
+}
+
+
+double FieldVolume::getSpacing() const {
+  return spacing;
+}
+
+
+cv::Vec3d FieldVolume::getPosition(int x, int y, int z) const {
+  return origin + spacing * cv::Vec3d(x, y, z);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+// stdlib
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iomanip>
+#include <string>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// user headers
+#include "util.hpp"
+
+
+
+/*
+  File backed nx x ny x nz grid of float32 field vectors, stored as z-slabs of interleaved xyz rows.
+  Slabs are written through short lived mappings of just that slab, so only the slabs in flight are resident
+  and volumes larger than memory can be generated. A finished volume is mapped read only for access.
+
+  File: "MVOL", uint32 version, uint32 nx, ny, nz, float64 origin[3], float64 spacing, padded to 64 bytes, then the slabs
+ */
+class FieldVolume {
+  int fd = -1;
+  bool writable = false;
+  int nx = 0;
+  int ny = 0;
+  int nz = 0;
+  cv::Vec3d origin;
+  double spacing = 1;
+  const unsigned char* mapped = nullptr; // Whole file, read only
+  size_t file_size = 0;
+
+  size_t slabOffset(int z) const;
+
+public:
+  FieldVolume();
+  ~FieldVolume();
+  FieldVolume(const FieldVolume&) = delete;
+  FieldVolume& operator=(const FieldVolume&) = delete;
+
+  bool create(const std::string& path, int nx, int ny, int nz, cv::Vec3d origin, double spacing);
+  bool open(const std::string& path);
+  void close();
+
+  // Write one slab of ny*nx*3 floats, safe to call from several threads for different slabs
+  bool writeSlab(int z, const float* values);
+
+  // Read, after open()
+  const float* getSlab(int z) const;
+  cv::Mat getSlabMat(int z) const; // Header over the mapping, no copy
+  cv::Vec3d get(int x, int y, int z) const;
+
+  // Get
+  int getSizeX() const;
+  int getSizeY() const;
+  int getSizeZ() const;
+  cv::Vec3d getOrigin() const;
+  double getSpacing() const;
+  cv::Vec3d getPosition(int x, int y, int z) const;
+};
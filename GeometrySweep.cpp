@@ -0,0 +1,255 @@
+
+// stdlib
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iomanip>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// User headers
+#include "GeometrySweep.hpp"
+#include "Motor.hpp"
+#include "Magnet.hpp"
+
+// Binary table: magic, version, record count, then fixed size records of 4 byte fields
+#define SWEEP_BINARY_MAGIC "MSWP"
+#define SWEEP_BINARY_VERSION 1
+#define SWEEP_RECORD_FIELDS 16
+
+
+
+GeometrySweep::GeometrySweep(MotorGeometry _base) :
+  base(_base)
+{
+  for(int i = 0; i < SWEEP_PARAMETER_NUM; i++){
+    range_begin[i] = range_end[i] = 0;
+    range_steps[i] = 0;
+  }
+}
+
+
+GeometrySweep::CoilKey GeometrySweep::coilKey(const MotorGeometry& g){
+  return CoilKey(g.poles, g.coil_length, g.coil_offset, g.coil_radius, g.coil_turns, g.coil_res);
+}
+
+
+GeometrySweep::MagnetKey GeometrySweep::magnetKey(const MotorGeometry& g){
+  return MagnetKey(g.magnet_pairs, g.magnet_current, g.magnet_depth, g.magnet_height, g.magnet_radius, g.magnet_res);
+}
+
+
+std::vector<MotorGeometry> GeometrySweep::variants() const {
+  // Cartesian product of all ranges, parameters without a range keep the base value
+  std::vector<MotorGeometry> geometries(1, base);
+
+  for(int p = 0; p < SWEEP_PARAMETER_NUM; p++){
+    if(range_steps[p] <= 0){
+      continue;
+    }
+    std::vector<MotorGeometry> expanded;
+    for(int i = 0; i < geometries.size(); i++){
+      for(int step = 0; step < range_steps[p]; step++){
+        float value = (range_steps[p] > 1) ? range_begin[p] + (range_end[p] - range_begin[p]) * step / (range_steps[p] - 1) : range_begin[p];
+        MotorGeometry g = geometries[i];
+        switch(p){
+          case SWEEP_COIL_LENGTH: g.coil_length = value; break;
+          case SWEEP_COIL_RADIUS: g.coil_radius = value; break;
+          case SWEEP_COIL_TURNS: g.coil_turns = lround(value); break;
+          case SWEEP_COIL_RES: g.coil_res = lround(value); break;
+          case SWEEP_MAGNET_PAIRS: g.magnet_pairs = lround(value); break;
+          case SWEEP_MAGNET_DEPTH: g.magnet_depth = value; break;
+        }
+        expanded.push_back(g);
+      }
+    }
+    geometries = expanded;
+  }
+  return geometries;
+}
+
+
+void GeometrySweep::evaluate(const MotorGeometry& g, SweepResult& result) const {
+  Motor motor = coil_cache.at(coilKey(g));
+  motor.setAnalyticDipoles(analytic_dipoles);
+  motor.addMagnets(magnet_cache.at(magnetKey(g)));
+
+  std::vector<float> torque_curve = motor.generateTorqueRippleVector();
+
+  double sum = 0;
+  result.geometry = g;
+  result.min_torque = result.max_torque = torque_curve[0];
+  for(int i = 0; i < torque_curve.size(); i++){
+    sum += torque_curve[i];
+    result.min_torque = std::min(result.min_torque, torque_curve[i]);
+    result.max_torque = std::max(result.max_torque, torque_curve[i]);
+  }
+  result.mean_torque = sum / torque_curve.size();
+  result.torque_ripple = (result.mean_torque != 0) ? (result.max_torque - result.min_torque) / fabs(result.mean_torque) : 0;
+}
+
+
+void GeometrySweep::setRange(SweepParameter parameter, float begin, float end, int steps){
+  range_begin[parameter] = begin;
+  range_end[parameter] = end;
+  range_steps[parameter] = steps;
+}
+
+
+void GeometrySweep::setAnalyticDipoles(bool _analytic_dipoles){
+  analytic_dipoles = _analytic_dipoles;
+}
+
+
+void GeometrySweep::setThreadCount(int _thread_count){
+  thread_count = std::max(1, _thread_count);
+}
+
+
+void GeometrySweep::clearCache(){
+  coil_cache.clear();
+  magnet_cache.clear();
+}
+
+
+void GeometrySweep::run(){
+  /*
+    1) Generate every distinct coil set and magnet set not already cached.
+    2) Evaluate each distinct variant on a worker thread, repeats copy the first result.
+    The caches are only read while the workers run.
+   */
+  std::vector<MotorGeometry> geometries = variants();
+  results = std::vector<SweepResult>(geometries.size());
+
+  std::vector<int> unique;
+  std::vector<int> first_index(geometries.size());
+  std::map<std::pair<CoilKey, MagnetKey>, int> seen;
+
+  for(int i = 0; i < geometries.size(); i++){
+    const MotorGeometry& g = geometries[i];
+
+    if(coil_cache.find(coilKey(g)) == coil_cache.end()){
+      Motor coil_motor(g.poles, 0, 10, 0.00001);
+      coil_motor.generateCoils(g.coil_length, g.coil_offset, g.coil_radius, g.coil_turns, g.coil_res);
+      coil_cache.emplace(coilKey(g), coil_motor);
+    }
+    if(magnet_cache.find(magnetKey(g)) == magnet_cache.end()){
+      Motor magnet_motor(g.poles, 0, 10, 0.00001);
+      magnet_motor.generateMagnets(g.magnet_pairs, g.magnet_current, g.magnet_depth, g.magnet_height, g.magnet_radius, g.magnet_res);
+      magnet_cache.emplace(magnetKey(g), magnet_motor.getMagnets());
+    }
+
+    auto inserted = seen.emplace(std::make_pair(coilKey(g), magnetKey(g)), i);
+    first_index[i] = inserted.first->second;
+    if(inserted.second){
+      unique.push_back(i);
+    }
+  }
+
+  std::atomic<int> next_variant(0);
+  auto worker = [&](){
+    for(int n = next_variant++; n < unique.size(); n = next_variant++){
+      evaluate(geometries[unique[n]], results[unique[n]]);
+    }
+  };
+
+  if(thread_count == 1){
+    worker();
+  }else{
+    std::vector<std::thread> workers;
+    for(int i = 0; i < thread_count; i++){
+      workers.emplace_back(worker);
+    }
+    for(int i = 0; i < workers.size(); i++){
+      workers[i].join();
+    }
+  }
+
+  for(int i = 0; i < geometries.size(); i++){
+    results[i] = results[first_index[i]];
+  }
+}
+
+
+const std::vector<SweepResult>& GeometrySweep::getResults() const {
+  return results;
+}
+
+
+bool GeometrySweep::writeCSV(const std::string& path) const {
+  FILE* file = fopen(path.c_str(), "w");
+  if(!file){
+    std::cout << "Could not open " << path << std::endl;
+    return false;
+  }
+
+  fprintf(file, "poles,coil_length,coil_offset,coil_radius,coil_turns,coil_res,magnet_pairs,magnet_current,magnet_depth,magnet_height,magnet_radius,magnet_res,mean_torque,min_torque,max_torque,torque_ripple\n");
+  for(int i = 0; i < results.size(); i++){
+    const SweepResult& r = results[i];
+    const MotorGeometry& g = r.geometry;
+    fprintf(file, "%d,%g,%g,%g,%d,%d,%d,%d,%g,%g,%g,%d,%.9g,%.9g,%.9g,%.9g\n",
+      g.poles, g.coil_length, g.coil_offset, g.coil_radius, g.coil_turns, g.coil_res,
+      g.magnet_pairs, g.magnet_current, g.magnet_depth, g.magnet_height, g.magnet_radius, g.magnet_res,
+      r.mean_torque, r.min_torque, r.max_torque, r.torque_ripple);
+  }
+  fclose(file);
+  return true;
+}
+
+
+bool GeometrySweep::writeBinary(const std::string& path) const {
+  /*
+    Header: "MSWP", uint32 version, uint32 record count.
+    Records: 16 little endian 4 byte fields in the CSV column order, ints as int32, the rest as float32.
+   */
+  FILE* file = fopen(path.c_str(), "wb");
+  if(!file){
+    std::cout << "Could not open " << path << std::endl;
+    return false;
+  }
+
+  uint32_t header[2] = {SWEEP_BINARY_VERSION, uint32_t(results.size())};
+  fwrite(SWEEP_BINARY_MAGIC, 1, 4, file);
+  fwrite(header, sizeof(uint32_t), 2, file);
+
+  for(int i = 0; i < results.size(); i++){
+    const SweepResult& r = results[i];
+    const MotorGeometry& g = r.geometry;
+    uint32_t record[SWEEP_RECORD_FIELDS];
+    int field = 0;
+    auto putInt = [&](int32_t value){ memcpy(&record[field++], &value, 4); };
+    auto putFloat = [&](float value){ memcpy(&record[field++], &value, 4); };
+
+    putInt(g.poles);
+    putFloat(g.coil_length);
+    putFloat(g.coil_offset);
+    putFloat(g.coil_radius);
+    putInt(g.coil_turns);
+    putInt(g.coil_res);
+    putInt(g.magnet_pairs);
+    putInt(g.magnet_current);
+    putFloat(g.magnet_depth);
+    putFloat(g.magnet_height);
+    putFloat(g.magnet_radius);
+    putInt(g.magnet_res);
+    putFloat(r.mean_torque);
+    putFloat(r.min_torque);
+    putFloat(r.max_torque);
+    putFloat(r.torque_ripple);
+    fwrite(record, sizeof(uint32_t), SWEEP_RECORD_FIELDS, file);
+  }
+  fclose(file);
+  return true;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+// stdlib
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <map>
+#include <tuple>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// user headers
+#include "util.hpp"
+#include "Motor.hpp"
+#include "Magnet.hpp"
+
+
+// Arguments of Motor(...), generateCoils(...) and generateMagnets(...) for one motor variant
+struct MotorGeometry {
+  int poles = 3;
+  float coil_length = 300;
+  float coil_offset = -150;
+  float coil_radius = 70;
+  int coil_turns = 4;
+  int coil_res = 30;
+  int magnet_pairs = 1;
+  int magnet_current = 1000;
+  float magnet_depth = 4;
+  float magnet_height = 4;
+  float magnet_radius = 40;
+  int magnet_res = 8;
+};
+
+
+enum SweepParameter {
+  SWEEP_COIL_LENGTH,
+  SWEEP_COIL_RADIUS,
+  SWEEP_COIL_TURNS,
+  SWEEP_COIL_RES,
+  SWEEP_MAGNET_PAIRS,
+  SWEEP_MAGNET_DEPTH,
+  SWEEP_PARAMETER_NUM
+};
+
+
+struct SweepResult {
+  MotorGeometry geometry;
+  float mean_torque;
+  float min_torque;
+  float max_torque;
+  float torque_ripple; // (max - min) / |mean|
+};
+
+
+/*
+  Evaluates the torque ripple curve of every combination of the swept parameters, in parallel over variants.
+  Coil sets and magnet sets are generated once per distinct sub-geometry and shared by all variants that use them,
+  and variants that repeat a geometry reuse its result.
+ */
+class GeometrySweep {
+  MotorGeometry base;
+  float range_begin[SWEEP_PARAMETER_NUM];
+  float range_end[SWEEP_PARAMETER_NUM];
+  int range_steps[SWEEP_PARAMETER_NUM];
+  bool analytic_dipoles = false;
+  int thread_count = 1;
+  std::vector<SweepResult> results;
+
+  typedef std::tuple<int, float, float, float, int, int> CoilKey;
+  typedef std::tuple<int, int, float, float, float, int> MagnetKey;
+  std::map<CoilKey, Motor> coil_cache; // Motors holding only the coils
+  std::map<MagnetKey, std::vector<Magnet>> magnet_cache;
+
+  static CoilKey coilKey(const MotorGeometry&);
+  static MagnetKey magnetKey(const MotorGeometry&);
+  std::vector<MotorGeometry> variants() const;
+  void evaluate(const MotorGeometry&, SweepResult&) const;
+
+public:
+  GeometrySweep(MotorGeometry base = MotorGeometry());
+  void setRange(SweepParameter, float begin, float end, int steps);
+  void setAnalyticDipoles(bool);
+  void setThreadCount(int);
+  void clearCache();
+  void run();
+
+  const std::vector<SweepResult>& getResults() const;
+  bool writeCSV(const std::string& path) const;
+  bool writeBinary(const std::string& path) const;
+};
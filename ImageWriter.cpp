@@ -0,0 +1,79 @@
+
+// stdlib
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iomanip>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// User headers
+#include "ImageWriter.hpp"
+
+
+
+ImageWriter::ImageWriter() :
+  worker(&ImageWriter::run, this)
+{}
+
+
+ImageWriter::~ImageWriter(){
+  flush();
+  {
+    std::lock_guard<std::mutex> lock(jobs_mutex);
+    stopping = true;
+  }
+  jobs_changed.notify_all();
+  worker.join();
+}
+
+
+void ImageWriter::write(const std::string& path, const cv::Mat& image){
+  {
+    std::lock_guard<std::mutex> lock(jobs_mutex);
+    jobs.push_back(Job{path, image});
+    pending++;
+  }
+  jobs_changed.notify_all();
+}
+
+
+void ImageWriter::flush(){
+  std::unique_lock<std::mutex> lock(jobs_mutex);
+  jobs_changed.wait(lock, [this](){ return pending == 0; });
+}
+
+
+void ImageWriter::run(){
+  std::unique_lock<std::mutex> lock(jobs_mutex);
+  while(true){
+    jobs_changed.wait(lock, [this](){ return stopping || !jobs.empty(); });
+    if(jobs.empty()){
+      return;
+    }
+    Job job = jobs.front();
+    jobs.pop_front();
+
+    // Encode without holding the lock
+    lock.unlock();
+    cv::Mat image = job.image;
+    bool exr = job.path.size() >= 4 && job.path.compare(job.path.size() - 4, 4, ".exr") == 0;
+    if(exr && image.depth() == CV_8U){
+      job.image.convertTo(image, CV_32F, 1.0 / 255);
+    }
+    if(!cv::imwrite(job.path, image)){
+      std::cout << "Could not write " << job.path << std::endl;
+    }
+    lock.lock();
+
+    pending--;
+    jobs_changed.notify_all();
+  }
+}
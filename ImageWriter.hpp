@@ -0,0 +1,56 @@
+#pragma once
+
+// stdlib
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iomanip>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// user headers
+#include "util.hpp"
+
+
+
+/*
+  Encodes and writes images on a background thread so rendering never waits on cv::imwrite.
+  Queued images share their data with the caller, so they must not be drawn into after write().
+  The file format follows the extension; 8 bit images written as .exr are converted to float in [0, 1].
+ */
+class ImageWriter {
+  struct Job {
+    std::string path;
+    cv::Mat image;
+  };
+
+  std::deque<Job> jobs;
+  std::mutex jobs_mutex;
+  std::condition_variable jobs_changed;
+  int pending = 0; // Queued plus being written
+  bool stopping = false;
+  std::thread worker;
+
+  void run();
+
+public:
+  ImageWriter();
+  ~ImageWriter();
+  ImageWriter(const ImageWriter&) = delete;
+  ImageWriter& operator=(const ImageWriter&) = delete;
+
+  void write(const std::string& path, const cv::Mat& image);
+  void flush(); // Blocks until every queued image is written
+};
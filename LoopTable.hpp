@@ -0,0 +1,101 @@
+#pragma once
+
+// stdlib
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iomanip>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// user headers
+#include "util.hpp"
+
+
+
+/*
+  Angles of the points of a discretised unit loop, point k at k * 2pi / res.
+  The common resolutions 4, 8, 16 and 30 have cos/sin tables built at compile time,
+  dispatchLoopResolution picks one of those or the generic type, which calls cos/sin at run time.
+  Both give the same points, so geometry does not depend on which path built it.
+ */
+
+
+// Taylor series of sin and cos after reducing x to [-pi, pi], accurate to double precision
+constexpr double constexprSin(double x){
+  while(x > M_PI){
+    x -= 2 * M_PI;
+  }
+  while(x < -M_PI){
+    x += 2 * M_PI;
+  }
+  double term = x;
+  double sum = x;
+  for(int n = 1; n < 20; n++){
+    term *= -x * x / ((2 * n) * (2 * n + 1));
+    sum += term;
+  }
+  return sum;
+}
+
+
+constexpr double constexprCos(double x){
+  return constexprSin(x + M_PI / 2);
+}
+
+
+template <int RES> struct UnitLoopTable {
+  double cos[RES];
+  double sin[RES];
+
+  constexpr UnitLoopTable() : cos(), sin() {
+    for(int k = 0; k < RES; k++){
+      cos[k] = constexprCos(2 * M_PI * k / RES);
+      sin[k] = constexprSin(2 * M_PI * k / RES);
+    }
+  }
+};
+
+
+// Loop with a compile time resolution, points wrap around every RES
+template <int RES> struct UnitLoop {
+  static constexpr UnitLoopTable<RES> table = UnitLoopTable<RES>();
+  static constexpr int resolution = RES;
+
+  double cos(int k) const { return table.cos[k % RES]; }
+  double sin(int k) const { return table.sin[k % RES]; }
+};
+
+
+// Any resolution, also non-integer ones whose loops do not close
+struct UnitLoopGeneric {
+  double d_theta;
+
+  UnitLoopGeneric(float res) : d_theta(2 * M_PI / res) {}
+
+  double cos(int k) const { return std::cos(k * d_theta); }
+  double sin(int k) const { return std::sin(k * d_theta); }
+};
+
+
+// Calls f with the UnitLoop of res if it has a table, otherwise with a UnitLoopGeneric
+template <typename F> void dispatchLoopResolution(float res, F&& f){
+  if(res == 4){
+    f(UnitLoop<4>());
+  }else if(res == 8){
+    f(UnitLoop<8>());
+  }else if(res == 16){
+    f(UnitLoop<16>());
+  }else if(res == 30){
+    f(UnitLoop<30>());
+  }else{
+    f(UnitLoopGeneric(res));
+  }
+}
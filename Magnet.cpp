@@ -19,6 +19,7 @@
 #include "Dipole.hpp"
 #include "World.hpp"
 #include "Controller.hpp"
+#include "Trace.hpp"
 
 
 
@@ -31,7 +32,9 @@ Magnet::Magnet(float _radius, float _angle, float _orientation, float d, float h
 
 
 void Magnet::generateDipolesPolar(float rotor_angle){
-  dipoles.clear();
+  TRACE_SCOPE("Magnet::generateDipolesPolar");
+  dipole_loops.clear();
+  dipole_prototype = Dipole(0, 0, 0, 1, 1, res).dipole_segments;
 
   for(float d_theta = 0; d_theta < angle; d_theta+=0.02){
     for(int d = 0; d < depth; d+=3){
@@ -39,87 +42,147 @@ void Magnet::generateDipolesPolar(float rotor_angle){
 
         float offset = radius + depth;
         int current = (polarity) ? current_density : -current_density;
-        float dipole_radius = angle * radius / (M_PI);
+        float dipole_orientation = orientation + d_theta + rotor_angle;
 
-        Dipole temp_dipole(offset, height, orientation + d_theta + rotor_angle, current, 1, res);
-        dipoles.push_back(temp_dipole);
+        // Same placement as Dipole(offset, height, dipole_orientation, current, 1, res)
+        cv::Vec3d normal(cos(dipole_orientation), sin(dipole_orientation), 0);
+        dipole_loops.push_back(cv::Vec3d(offset * normal[0], offset * normal[1], height), normal, current, 1);
       }
     }
   }
+  TRACE_COUNT(TRACE_DIPOLES_ALLOCATED, dipole_loops.size());
 }
 
 
+// A single large loop instead of the polar dipoles
 void Magnet::generateDipolesCartesian(){
   cv::Point2f pos = cv::Point2f(0,0);
   float angle = 0;
   Dipole temp_dipole(pos, angle, 1000, 20, 20);
-  dipoles.push_back(temp_dipole);
+  dipole_prototype = Dipole(cv::Point2f(0, 0), 0, 1, 20, 20).dipole_segments;
+  dipole_loops.clear();
+  dipole_loops.push_back(temp_dipole);
 }
 
 
-cv::Vec3d Magnet::getFieldVectorAtPos(cv::Vec3d pos){
-  cv::Vec3d d_field;
-  for(int i = 0; i < dipoles.size(); i++){
-    Dipole temp_dipole = dipoles[i];
-    d_field += temp_dipole.getFieldVectorAtPos(pos);
-  }  
-  return d_field;
+// All instances of the prototype are summed in one pass, always in double
+cv::Vec3d Magnet::getFieldVectorAtPos(const cv::Vec3d& pos) const {
+  // Evaluate in the rotor frame and rotate the result back
+  cv::Vec3d rotor_pos = rotateVector3D_z(pos, rotor_cos, -rotor_sin);
+  cv::Vec3d field;
+  if(analytic_field){
+    field = dipole_loops.getFieldVectorAtPos(rotor_pos);
+  }else{
+    field = dipole_loops.getInstancedFieldVectorAtPos(dipole_prototype, rotor_pos);
+  }
+  return rotateVector3D_z(field, rotor_cos, rotor_sin);
+}
+
+
+// Turning the rotor only changes the frame transform, the dipoles are left as generated
+void Magnet::setRotorAngle(float _rotor_angle){
+  setRotorAngle(_rotor_angle, cos(_rotor_angle), sin(_rotor_angle));
+}
+
+
+void Magnet::setRotorAngle(float _rotor_angle, double cos_angle, double sin_angle){
+  rotor_angle = _rotor_angle;
+  rotor_cos = cos_angle;
+  rotor_sin = sin_angle;
+}
+
+
+float Magnet::getRotorAngle() const {
+  return rotor_angle;
 }
 
 
-cv::Mat Magnet::renderMagnet_xy(cv::Mat& canvas){
+FieldVector Magnet::toWorldFrame(const FieldVector& field_vector) const {
+  FieldVector world_vector;
+  world_vector.pos = rotateVector3D_z(field_vector.pos, rotor_cos, rotor_sin);
+  world_vector.dir = rotateVector3D_z(field_vector.dir, rotor_cos, rotor_sin);
+  return world_vector;
+}
+
+
+void Magnet::setAnalyticField(bool _analytic_field){
+  analytic_field = _analytic_field;
+}
+
+
+cv::Mat Magnet::renderMagnet_xy(cv::Mat& canvas) const {
   cv::Point offset = cv::Point(canvas_size.width/2, canvas_size.height/2);
 
-  for(int n = 0; n < dipoles.size(); n++){
-    Dipole temp_dipole = dipoles[n];
-    for(int i = 0; i < temp_dipole.dipole_wire_vectors.size(); i++){
-      FieldVector v = temp_dipole.dipole_wire_vectors[i];
-      cv::Point start = cv::Point(v.pos[0], v.pos[1]) + offset;
-      cv::Point end = cv::Point(v.pos[0] + v.dir[0], v.pos[1] + v.dir[1]) + offset;
-      if(polarity){
-        cv::line(canvas, start, end, cv::Scalar(0, 0, 255), 2);
-      }
-      else{
-        cv::line(canvas, start, end, cv::Scalar(255, 0, 0), 2);
-      }
+  forEachSegment([&](const FieldVector& rotor_vector, double){
+    FieldVector v = toWorldFrame(rotor_vector);
+    cv::Point start = cv::Point(v.pos[0], v.pos[1]) + offset;
+    cv::Point end = cv::Point(v.pos[0] + v.dir[0], v.pos[1] + v.dir[1]) + offset;
+    if(polarity){
+      cv::line(canvas, start, end, cv::Scalar(0, 0, 255), 2);
     }
-  }
+    else{
+      cv::line(canvas, start, end, cv::Scalar(255, 0, 0), 2);
+    }
+  });
   return canvas;
 }
 
 
-cv::Mat Magnet::renderMagnet_xz(cv::Mat& canvas){
+cv::Mat Magnet::renderMagnet_xz(cv::Mat& canvas) const {
   cv::Point offset = cv::Point(0, canvas_size.height/2);
 
-  for(int n = 0; n < dipoles.size(); n++){
-    Dipole temp_dipole = dipoles[n];
-    for(int i = 0; i < temp_dipole.dipole_wire_vectors.size(); i++){
-      FieldVector v = temp_dipole.dipole_wire_vectors[i];
-      cv::Point start = cv::Point(v.pos[0], v.pos[2]) + offset;
-      cv::Point end = cv::Point(v.pos[0] + v.dir[0], v.pos[2] + v.dir[2]) + offset;
-      cv::line(canvas, start, end, cv::Scalar(0, 255, 0), 1);
-    }
-  }
+  forEachSegment([&](const FieldVector& rotor_vector, double){
+    FieldVector v = toWorldFrame(rotor_vector);
+    cv::Point start = cv::Point(v.pos[0], v.pos[2]) + offset;
+    cv::Point end = cv::Point(v.pos[0] + v.dir[0], v.pos[2] + v.dir[2]) + offset;
+    cv::line(canvas, start, end, cv::Scalar(0, 255, 0), 1);
+  });
   return canvas;
 }
 
 
-cv::Mat Magnet::renderMagnet_yz(cv::Mat& canvas){
+cv::Mat Magnet::renderMagnet_yz(cv::Mat& canvas) const {
   cv::Point offset = cv::Point(0, canvas_size.height/2);
 
-  for(int n = 0; n < dipoles.size(); n++){
-    Dipole temp_dipole = dipoles[n];
-    for(int i = 0; i < temp_dipole.dipole_wire_vectors.size(); i++){
-      FieldVector v = temp_dipole.dipole_wire_vectors[i];
-      cv::Point start = cv::Point(v.pos[1], v.pos[2]) + offset;
-      cv::Point end = cv::Point(v.pos[1] + v.dir[1], v.pos[2] + v.dir[2]) + offset;
-      cv::line(canvas, start, end, cv::Scalar(0, 255, 0), 1);
+  forEachSegment([&](const FieldVector& rotor_vector, double){
+    FieldVector v = toWorldFrame(rotor_vector);
+    cv::Point start = cv::Point(v.pos[1], v.pos[2]) + offset;
+    cv::Point end = cv::Point(v.pos[1] + v.dir[1], v.pos[2] + v.dir[2]) + offset;
+    cv::line(canvas, start, end, cv::Scalar(0, 255, 0), 1);
+  });
+  return canvas;
+}
+
+
+void Magnet::forEachSegment(const std::function<void(const FieldVector&, double current)>& segment_func) const {
+  for(size_t i = 0; i < dipole_loops.size(); i++){
+    for(size_t k = 0; k < dipole_prototype.size(); k++){
+      segment_func(dipole_loops.getInstanceSegment(dipole_prototype, i, k), dipole_loops.current[i]);
     }
   }
-  return canvas;
 }
 
 
-std::vector<Dipole> Magnet::getDipoles(){
-  return dipoles;
+size_t Magnet::getDipoleCount() const {
+  return dipole_loops.size();
+}
+
+
+size_t Magnet::getSegmentCount() const {
+  return dipole_loops.size() * dipole_prototype.size();
+}
+
+
+const WireSegments& Magnet::getDipolePrototype() const {
+  return dipole_prototype;
+}
+
+
+const DipoleArray& Magnet::getDipoleLoops() const {
+  return dipole_loops;
+}
+
+
+size_t Magnet::getBytes() const {
+  return dipole_prototype.getBytes() + dipole_loops.getBytes();
 }
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <cmath>
 #include <iomanip>
+#include <functional>
 
 // opencv
 #include <opencv2/core/core.hpp>
@@ -17,6 +18,8 @@
 
 // user headers
 #include "util.hpp"
+#include "WireSegments.hpp"
+#include "DipoleArray.hpp"
 
 
 
@@ -29,16 +32,34 @@ class Magnet{
   float current_density;
   bool polarity; // true = north, south = false
   int res;
+  bool analytic_field = false; // Closed form loops instead of dipole segments
+  // Dipoles are stored in the rotor frame, the rotor angle is applied to queries and results
+  float rotor_angle = 0;
+  double rotor_cos = 1;
+  double rotor_sin = 0;
 
-  std::vector<Dipole> dipoles;
+  // Every dipole is the same loop, so the segments are stored once and each dipole is an instance of them
+  WireSegments dipole_prototype; // One dipole at unit current in its own frame, normal along x
+  DipoleArray dipole_loops; // Center, normal and current of every dipole, also used as ideal loops
 public:
   Magnet(float radius, float angle, float orientation, float d, float h, float i_density, int res, bool polarity);
   void generateDipolesPolar(float rotor_angle);
   void generateDipolesCartesian();
-  cv::Vec3d getFieldVectorAtPos(cv::Vec3d);
+  cv::Vec3d getFieldVectorAtPos(const cv::Vec3d&) const;
+  void setAnalyticField(bool);
+  void setRotorAngle(float);
+  void setRotorAngle(float, double cos_angle, double sin_angle);
+  float getRotorAngle() const;
+  FieldVector toWorldFrame(const FieldVector&) const;
 
-  std::vector<Dipole> getDipoles();
-  cv::Mat renderMagnet_xy(cv::Mat& canvas);
-  cv::Mat renderMagnet_xz(cv::Mat& canvas);
-  cv::Mat renderMagnet_yz(cv::Mat& canvas);
+  // Dipole segments in the rotor frame, with the current of their dipole
+  void forEachSegment(const std::function<void(const FieldVector&, double current)>&) const;
+  size_t getDipoleCount() const;
+  size_t getSegmentCount() const;
+  const WireSegments& getDipolePrototype() const;
+  const DipoleArray& getDipoleLoops() const;
+  size_t getBytes() const; // Heap bytes held
+  cv::Mat renderMagnet_xy(cv::Mat& canvas) const;
+  cv::Mat renderMagnet_xz(cv::Mat& canvas) const;
+  cv::Mat renderMagnet_yz(cv::Mat& canvas) const;
 };
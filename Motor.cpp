@@ -19,12 +19,13 @@
 #include "Dipole.hpp"
 #include "World.hpp"
 #include "Controller.hpp"
+#include "Trace.hpp"
 
 
 
 
 Motor::Motor(int _poles, float r, float I, float _dt) :
-  radius(r), inertia(I), poles(_poles), dt(_dt)
+  rotor_angle(0), radius(r), inertia(I), poles(_poles), dt(_dt)
 {}
 
 
@@ -34,29 +35,43 @@ void Motor::generateCoils(float l, float offset, float r, int N, int res){
     float angle = i*2*M_PI/poles;
     cv::Point2d pos(0, 0);
     Coil temp_coil = Coil(l, r, N, angle, pos, offset, res, dt);
-    // Push back to UVW vectors
-    if((i%3) == 0){ // U
-      U.push_back(temp_coil);
-    }else if((i%3) == 1){ // V
-      V.push_back(temp_coil);
-    }else if((i%3) == 2){ // W
-      W.push_back(temp_coil);
+    // Insert at the end of its U, V or W group
+    int phase = i%3;
+    coils.insert(coils.begin() + phase_end[phase], temp_coil);
+    for(int p = phase; p < 3; p++){
+      phase_end[p]++;
     }
   }
+  torque_map.invalidate();
+  phase_model.invalidate();
+  TRACE_VALUE("motor_bytes", getBytes());
 }
 
 
 void Motor::generateMagnets(int N_pairs, int I, float depth, float height, float radius, int res){
   float angle = 2*M_PI / (N_pairs * 2);
 
+  std::vector<Magnet> new_magnets;
   for(int i = 0; i < N_pairs; i++){
     float orientation = 2*i*angle;
 
-    Magnet magnet_north(radius, angle, orientation, depth, height, I, res, false);
-    Magnet magnet_south(radius, angle, orientation + angle, depth, height, I, res, true);
-    magnets.push_back(magnet_north);
-    magnets.push_back(magnet_south);
+    new_magnets.push_back(Magnet(radius, angle, orientation, depth, height, I, res, false));
+    new_magnets.push_back(Magnet(radius, angle, orientation + angle, depth, height, I, res, true));
   }
+  addMagnets(new_magnets);
+}
+
+
+// Adds already generated magnets, e.g. shared between motors that only differ in their coils
+void Motor::addMagnets(const std::vector<Magnet>& new_magnets){
+  for(int i = 0; i < new_magnets.size(); i++){
+    magnets.push_back(new_magnets[i]);
+    magnets.back().setAnalyticField(analytic_dipoles);
+    magnets.back().setRotorAngle(rotor_angle, rotor_cos, rotor_sin);
+  }
+  buildDipoleTree();
+  torque_map.invalidate();
+  TRACE_VALUE("motor_bytes", getBytes());
 }
 
 
@@ -76,7 +91,22 @@ std::vector<float> Motor::generateTorqueRippleVector(){
 }
 
 
-cv::Vec3d Motor::getForceOnDipoleAtPos(Dipole temp_dipole){
+// Same sweep as above, with the rotor field taken from a fitted harmonic model instead of regenerated dipoles
+std::vector<float> Motor::generateTorqueRippleVector(RotorFieldModel& rotor_model){
+  std::vector<float> torque_curve;
+  for(int theta_deg = 0; theta_deg < 360; theta_deg++){
+    float theta_rad = float(theta_deg) * DEG_2_RAD;
+
+    rotor_model.setRotorAngle(theta_rad + M_PI);
+    setCurrentVector(theta_rad, 1);
+
+    torque_curve.push_back(calculateTorque(rotor_model));
+  }
+  return torque_curve;
+}
+
+
+cv::Vec3d Motor::getForceOnDipoleAtPos(const Dipole& temp_dipole) const {
   cv::Vec3d force;
 
   /* 
@@ -85,28 +115,24 @@ cv::Vec3d Motor::getForceOnDipoleAtPos(Dipole temp_dipole){
     3) Sum up all forces
    */
 
-  // Get coils and magnets from motor
-  std::vector<Coil> coils = getCoils();
-  std::vector<Magnet> magnets = getMagnets();
-
   // Run through all coils and dipoles in motor and calculate their force on the dipole
   for(int dipole_dl_num = 0; dipole_dl_num < temp_dipole.dipole_wire_vectors.size(); dipole_dl_num++){
     // Dipole dl
-    FieldVector field_vector = temp_dipole.dipole_wire_vectors[dipole_dl_num];
+    const FieldVector& field_vector = temp_dipole.dipole_wire_vectors[dipole_dl_num];
     
     // Calculate force form coils
     for(int coil_num = 0; coil_num < coils.size(); coil_num++){
-      Coil coil = coils[coil_num];
-      force += coil.forceOnWireDL(field_vector, temp_dipole.getCurrent());
+      force += coils[coil_num].forceOnWireDL(field_vector, temp_dipole.getCurrent());
     }
 
     // Calculate force from dipoles
+    if(dipole_tree_active){
+      force += temp_dipole.getCurrent() * field_vector.dir.cross(getMagnetFieldVectorAtPos(field_vector.pos));
+      continue;
+    }
+    // dF = i dL x B, with B from all dipoles of a magnet at once
     for(int magnet_num = 0; magnet_num < magnets.size(); magnet_num++){
-      std::vector<Dipole> dipoles = magnets[magnet_num].getDipoles();
-      for(int dipole_num = 0; dipole_num < dipoles.size(); dipole_num++){
-        Dipole dipole = dipoles[dipole_num];
-        force += dipole.forceOnWireDL(field_vector, temp_dipole.getCurrent());
-      }
+      force += temp_dipole.getCurrent() * field_vector.dir.cross(magnets[magnet_num].getFieldVectorAtPos(field_vector.pos));
     }
   }
 
@@ -114,31 +140,68 @@ cv::Vec3d Motor::getForceOnDipoleAtPos(Dipole temp_dipole){
 }
 
 
-float Motor::calculateTorque(){
-  std::vector<Dipole> dipoles;
-  // Get all dipoles in motor
-  for(int i = 0; i < magnets.size(); i++){
-    std::vector<Dipole> temp_dipoles = magnets[i].getDipoles();
+float Motor::calculateTorque() const {
+  TRACE_SCOPE("Motor::calculateTorque");
+  // Closed form dipoles have no segments to push on, so the torque is taken from the reaction on the coils
+  if(analytic_dipoles){
+    return calculateCoilReactionTorque([&](const cv::Vec3d& pos){
+      cv::Vec3d field;
+      for(int i = 0; i < magnets.size(); i++){
+        field += magnets[i].getFieldVectorAtPos(pos);
+      }
+      return field;
+    });
+  }
+
+  // Many small terms of both signs, summed in double
+  double torque = 0;
+
+  // All dipole segments in motor, each instanced and moved from the rotor frame to the world frame once for all coils
+  for(int magnet_num = 0; magnet_num < magnets.size(); magnet_num++){
+    const Magnet& magnet = magnets[magnet_num];
+    const DipoleArray& dipole_loops = magnet.getDipoleLoops();
+    const WireSegments& prototype = magnet.getDipolePrototype();
+
+    for(size_t dipole_num = 0; dipole_num < dipole_loops.size(); dipole_num++){
+      for(size_t segment_num = 0; segment_num < prototype.size(); segment_num++){
+        FieldVector field_vector = magnet.toWorldFrame(dipole_loops.getInstanceSegment(prototype, dipole_num, segment_num));
+
+        for(int coil_num = 0; coil_num < coils.size(); coil_num++){
+          cv::Vec3d force = coils[coil_num].forceOnWireDL(field_vector, dipole_loops.current[dipole_num]);
+          cv::Vec3d d_torque = field_vector.pos.cross(force);
 
-    for(int j = 0; j < temp_dipoles.size(); j++){
-      dipoles.push_back(temp_dipoles[j]);
+          torque += d_torque[2];
+        }
+      }
     }
   }
+  return torque;
+}
 
-  float torque = 0;
 
-  for(int coil_num = 0; coil_num < getCoils().size(); coil_num++){
-    Coil coil = getCoils()[coil_num];
-      
-    for(int dipole_num = 0; dipole_num < dipoles.size(); dipole_num++){
+float Motor::calculateTorque(const RotorFieldModel& rotor_model) const {
+  TRACE_SCOPE("Motor::calculateTorque");
+  return calculateCoilReactionTorque([&](const cv::Vec3d& pos){
+    return rotor_model.getFieldVectorAtPos(pos);
+  });
+}
 
-      Dipole dipole = dipoles[dipole_num];
-      std::vector<FieldVector> dipole_field_vectors = dipole.dipole_wire_vectors;
 
-      for(int dipole_field_vector_num = 0; dipole_field_vector_num < dipole_field_vectors.size(); dipole_field_vector_num++){
-        FieldVector field_vector = dipole_field_vectors[dipole_field_vector_num];
-        
-        cv::Vec3d force = coil.forceOnWireDL(field_vector, dipole.getCurrent());
+float Motor::calculateCoilReactionTorque(const std::function<cv::Vec3d(const cv::Vec3d&)>& rotor_field) const {
+  /* 
+    Torque from the reaction on the coils: dF = i dL x B_rotor on every coil segment.
+    This equals the sum over dipole segments in calculateTorque(), with the same sign convention.
+   */
+  double torque = 0;
+
+  for(int phase = 0; phase < 3; phase++){
+    ConstView<Coil> phase_coils = getPhaseCoils(phase);
+    for(int coil_num = 0; coil_num < phase_coils.size(); coil_num++){
+      const std::vector<FieldVector>& coil_field_vectors = phase_coils[coil_num].coil_wire_vectors;
+
+      for(int i = 0; i < coil_field_vectors.size(); i++){
+        const FieldVector& field_vector = coil_field_vectors[i];
+        cv::Vec3d force = current[phase] * field_vector.dir.cross(rotor_field(field_vector.pos));
         cv::Vec3d d_torque = field_vector.pos.cross(force);
 
         torque += d_torque[2];
@@ -149,28 +212,206 @@ float Motor::calculateTorque(){
 }
 
 
+// Interpolated torque at the current rotor angle and current vector, generating the torque map on first use
+float Motor::lookupTorque(){
+  if(!torque_map.isValid()){
+    torque_map.generate(*this);
+  }
+  return torque_map.getTorque(rotor_angle, current_vector);
+}
+
+
+double Motor::rotorAcceleration(double angle, double speed) const {
+  return (torque_map.getTorque(angle, current_vector) - damping * speed - load_torque) / inertia;
+}
+
+
+void Motor::update(float dt){
+  /*
+    Advances rotor angle and speed by one fixed step.
+    Torque comes from the torque map, so a step costs a few interpolations instead of a field integration.
+    When voltage driven the phase currents are first advanced by the phase model, then held constant over the step.
+   */
+  if(!torque_map.isValid()){
+    torque_map.generate(*this);
+  }
+
+  if(voltage_driven){
+    if(!phase_model.isValid()){
+      phase_model.generate(*this);
+    }
+    current = phase_model.step(current, voltage, torque_map, rotor_angle, rotor_speed, dt);
+    current_vector = clark(current);
+    applyCoilCurrents();
+  }
+
+  double angle = rotor_angle;
+  double speed = rotor_speed;
+
+  if(integrator == INTEGRATOR_RK4){
+    double k1_angle = speed;
+    double k1_speed = rotorAcceleration(angle, speed);
+    double k2_angle = speed + 0.5 * dt * k1_speed;
+    double k2_speed = rotorAcceleration(angle + 0.5 * dt * k1_angle, k2_angle);
+    double k3_angle = speed + 0.5 * dt * k2_speed;
+    double k3_speed = rotorAcceleration(angle + 0.5 * dt * k2_angle, k3_angle);
+    double k4_angle = speed + dt * k3_speed;
+    double k4_speed = rotorAcceleration(angle + dt * k3_angle, k4_angle);
+
+    angle += dt / 6 * (k1_angle + 2 * k2_angle + 2 * k3_angle + k4_angle);
+    speed += dt / 6 * (k1_speed + 2 * k2_speed + 2 * k3_speed + k4_speed);
+  }else{
+    // Speed first, then angle from the new speed
+    speed += dt * rotorAcceleration(angle, speed);
+    angle += dt * speed;
+  }
+
+  angle = fmod(angle, 2 * M_PI);
+  if(angle < 0){
+    angle += 2 * M_PI;
+  }
+
+  rotor_speed = speed;
+  setRotorFrame(angle);
+  torque = torque_map.getTorque(rotor_angle, current_vector);
+}
+
+
+// Field from all magnets, through the dipole tree when enabled
+cv::Vec3d Motor::getMagnetFieldVectorAtPos(const cv::Vec3d& pos) const {
+  if(dipole_tree_active){
+    cv::Vec3d rotor_pos = rotateVector3D_z(pos, rotor_cos, -rotor_sin);
+    return rotateVector3D_z(dipole_tree.getFieldVectorAtPos(rotor_pos), rotor_cos, rotor_sin);
+  }
+  cv::Vec3d field;
+  for(int i = 0; i < magnets.size(); i++){
+    field += magnets[i].getFieldVectorAtPos(pos);
+  }
+  return field;
+}
+
+
+void Motor::buildDipoleTree(){
+  // Rebuilt whenever the magnets change, so the tree comes back once they are compatible again
+  dipole_tree_active = false;
+  if(!use_dipole_tree){
+    dipole_tree.clear();
+    return;
+  }
+  std::vector<const DipoleArray*> dipole_arrays;
+  for(int i = 0; i < magnets.size(); i++){
+    dipole_arrays.push_back(&magnets[i].getDipoleLoops());
+  }
+  if(analytic_dipoles || magnets.empty()){
+    dipole_tree.build(dipole_arrays);
+    dipole_tree_active = true;
+    return;
+  }
+
+  // Segment dipoles, the tree's leaves need one prototype loop shared by all magnets
+  const WireSegments& prototype = magnets[0].getDipolePrototype();
+  for(int i = 1; i < magnets.size(); i++){
+    const WireSegments& other = magnets[i].getDipolePrototype();
+    if(other.pos_x != prototype.pos_x || other.pos_y != prototype.pos_y || other.pos_z != prototype.pos_z ||
+       other.dir_x != prototype.dir_x || other.dir_y != prototype.dir_y || other.dir_z != prototype.dir_z){
+      dipole_tree.clear();
+      return;
+    }
+  }
+  dipole_tree.build(dipole_arrays, &prototype);
+  dipole_tree_active = true;
+}
+
+
 // Set methods
 void Motor::setRotorAngle(float angle){
+  setRotorFrame(angle);
+}
+
+
+void Motor::setRotorFrame(double angle){
+  // Magnets and dipole tree stay in the rotor frame, only the frame transform changes
+  rotor_angle = angle;
+  rotor_cos = cos(angle);
+  rotor_sin = sin(angle);
   for(int i = 0; i < magnets.size(); i++){
-    Magnet& magnet = magnets[i];
-    magnet.generateDipolesPolar(angle);
+    magnets[i].setRotorAngle(angle, rotor_cos, rotor_sin);
   }
 }
 
 
-void Motor::setCurrentVector(cv::Vec2d current_vector){
-  current = clarkInv(current_vector);
+void Motor::setSpeed(float speed){
+  rotor_speed = speed;
+}
 
 
-  for(int i = 0; i < U.size(); i++){
-    U[i].setCurrent(current[0]);
-  }
-  for(int i = 0; i < V.size(); i++){
-    V[i].setCurrent(current[1]);
+void Motor::setDamping(float _damping){
+  damping = _damping;
+}
+
+
+void Motor::setLoadTorque(float _load_torque){
+  load_torque = _load_torque;
+}
+
+
+void Motor::setIntegrator(Integrator _integrator){
+  integrator = _integrator;
+}
+
+
+void Motor::setVoltageDriven(bool _voltage_driven){
+  voltage_driven = _voltage_driven;
+}
+
+
+// Applied from the next update on when voltage driven, otherwise only held
+void Motor::setVoltages(float U, float V, float W){
+  voltage = cv::Vec3d(U, V, W);
+}
+
+
+void Motor::setCurrents(float U, float V, float W){
+  current = cv::Vec3d(U, V, W);
+  current_vector = clark(current);
+  applyCoilCurrents();
+}
+
+
+// Push the U-V-W currents to every coil of the matching phase
+void Motor::applyCoilCurrents(){
+  int phase = 0;
+  for(int i = 0; i < coils.size(); i++){
+    while(i >= phase_end[phase]){
+      phase++;
+    }
+    coils[i].setCurrent(current[phase]);
   }
-  for(int i = 0; i < W.size(); i++){
-    W[i].setCurrent(current[2]);
+}
+
+
+bool Motor::setDipoleTree(bool enabled, float opening_angle){
+  use_dipole_tree = enabled;
+  dipole_tree.setOpeningAngle(opening_angle);
+  buildDipoleTree();
+  return dipole_tree_active == enabled;
+}
+
+
+void Motor::setAnalyticDipoles(bool _analytic_dipoles){
+  analytic_dipoles = _analytic_dipoles;
+  for(int i = 0; i < magnets.size(); i++){
+    magnets[i].setAnalyticField(analytic_dipoles);
   }
+  buildDipoleTree();
+  torque_map.invalidate();
+}
+
+
+void Motor::setCurrentVector(cv::Vec2d _current_vector){
+  current_vector = _current_vector;
+  current = clarkInv(current_vector);
+  applyCoilCurrents();
 }
 
 
@@ -183,44 +424,126 @@ void Motor::setCurrentVector(float angle, float magnitude){
 
 
 // Get metods
-std::vector<Coil> Motor::getCoils(){
-  std::vector<Coil> coils;
+ConstView<Coil> Motor::getCoils() const {
+  return ConstView<Coil>(coils);
+}
 
-  for(int i = 0; i < U.size(); i++){
-    coils.push_back(U[i]);
-  }
-  for(int i = 0; i < V.size(); i++){
-    coils.push_back(V[i]);
+
+ConstView<Coil> Motor::getPhaseCoils(int phase) const {
+  int begin = (phase == 0) ? 0 : phase_end[phase - 1];
+  return ConstView<Coil>(coils.data() + begin, phase_end[phase] - begin);
+}
+
+
+const std::vector<Magnet>& Motor::getMagnets() const {
+  return magnets;
+}
+
+
+size_t Motor::getBytes() const {
+  size_t bytes = sizeof(Motor) + coils.capacity() * sizeof(Coil) + magnets.capacity() * sizeof(Magnet);
+  for(int i = 0; i < coils.size(); i++){
+    bytes += coils[i].getBytes();
   }
-  for(int i = 0; i < W.size(); i++){
-    coils.push_back(W[i]);
+  for(int i = 0; i < magnets.size(); i++){
+    bytes += magnets[i].getBytes();
   }
+  return bytes + torque_map.getBytes() + dipole_tree.getBytes();
+}
 
-  return coils;
+
+float Motor::getAngle() const {
+  return rotor_angle;
 }
 
 
-std::vector<Magnet> Motor::getMagnets(){
-  return magnets;
+float Motor::getSpeed() const {
+  return rotor_speed;
+}
+
+
+float Motor::getInertia() const {
+  return inertia;
+}
+
+
+float Motor::getDamping() const {
+  return damping;
+}
+
+
+float Motor::getLoadTorque() const {
+  return load_torque;
+}
+
+
+float Motor::getTorque() const {
+  return torque;
 }
 
 
-cv::Vec3d Motor::getCurrents(){
+cv::Vec3d Motor::getVoltages() const {
+  return voltage;
+}
+
+
+MotorState Motor::getState() const {
+  MotorState state;
+  state.angle = rotor_angle;
+  state.speed = rotor_speed;
+  state.torque = torque;
+  state.currents = current;
+  state.voltages = voltage;
+  return state;
+}
+
+
+cv::Vec3d Motor::getCurrents() const {
   return current;
 }
 
 
+cv::Vec2d Motor::getCurrentVector() const {
+  return current_vector;
+}
+
+
+TorqueMap& Motor::getTorqueMap(){
+  return torque_map;
+}
+
+
+const TorqueMap& Motor::getTorqueMap() const {
+  return torque_map;
+}
+
+
+PhaseModel& Motor::getPhaseModel(){
+  return phase_model;
+}
+
+
+bool Motor::isVoltageDriven() const {
+  return voltage_driven;
+}
+
+
+bool Motor::isDipoleTreeActive() const {
+  return dipole_tree_active;
+}
+
+
 // Render methods
-cv::Mat Motor::renderMotorCoils(cv::Mat& canvas){
+cv::Mat Motor::renderMotorCoils(cv::Mat& canvas) const {
   // cv::Mat canvas = cv::Mat(canvas_size, CV_8UC3, cv::Scalar(255, 255, 255));
-  for(int i = 0; i < getCoils().size(); i++){
-    getCoils()[i].renderCoil_xy(canvas);
+  for(int i = 0; i < coils.size(); i++){
+    coils[i].renderCoil_xy(canvas);
   }
   return canvas;
 }
 
 
-cv::Mat Motor::renderMagnets(cv::Mat& canvas){
+cv::Mat Motor::renderMagnets(cv::Mat& canvas) const {
   // cv::Mat canvas = cv::Mat(canvas_size, CV_8UC3, cv::Scalar(255, 255, 255));
   for(int i = 0; i < magnets.size(); i++){
     magnets[i].renderMagnet_xy(canvas);
@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <cmath>
 #include <iomanip>
+#include <functional>
 
 // opencv
 #include <opencv2/core/core.hpp>
@@ -20,49 +21,118 @@
 #include "Dipole.hpp"
 #include "util.hpp"
 #include "Magnet.hpp"
+#include "RotorFieldModel.hpp"
+#include "TorqueMap.hpp"
+#include "PhaseModel.hpp"
+#include "DipoleTree.hpp"
 
 
 
 
 
+// Fixed-step schemes for the rotor's angle and speed
+enum Integrator {
+  INTEGRATOR_SEMI_IMPLICIT_EULER,
+  INTEGRATOR_RK4
+};
+
+
+// Snapshot of the rotor and phases after the last update
+struct MotorState {
+  float angle;
+  float speed;
+  float torque;
+  cv::Vec3d currents; // U-V-W
+  cv::Vec3d voltages; // U-V-W
+};
+
+
 class Motor {
-  std::vector<Coil> U;
-  std::vector<Coil> V;
-  std::vector<Coil> W;
+  std::vector<Coil> coils; // Grouped by phase: U, then V, then W
+  int phase_end[3] = {0, 0, 0}; // One past the last coil of each phase
   std::vector<Magnet> magnets;
-  float rotor_angle;
+  double rotor_angle; // Kept in double so slow rotors still advance over long runs
+  double rotor_speed = 0;
+  double rotor_cos = 1;
+  double rotor_sin = 0;
   float radius;
   float inertia;
   int poles;
   float dt;
-  float torque;
+  float torque = 0;
+  float damping = 0; // Viscous friction, torque per rad/s
+  float load_torque = 0;
+  Integrator integrator = INTEGRATOR_RK4;
   cv::Vec3d current; // U-V-W
+  cv::Vec3d voltage; // U-V-W
+  cv::Vec2d current_vector; // Alpha-beta
+  TorqueMap torque_map; // Invalidated whenever coils or magnets change
+  PhaseModel phase_model; // Inductances, invalidated whenever coils change. Back-EMF comes from the torque map
+  bool voltage_driven = false; // Phase currents follow the voltages through the phase model
+  bool analytic_dipoles = false;
+  DipoleTree dipole_tree; // Over all magnet dipoles in the rotor frame
+  bool use_dipole_tree = false; // As requested by setDipoleTree
+  bool dipole_tree_active = false; // Tree in use, recomputed on every rebuild
+  void buildDipoleTree();
+  void setRotorFrame(double angle);
+  void applyCoilCurrents();
+  double rotorAcceleration(double angle, double speed) const;
+  float calculateCoilReactionTorque(const std::function<cv::Vec3d(const cv::Vec3d&)>& rotor_field) const;
 
 public:
   Motor(int poles, float r, float inertia, float dt);
   void generateCoils(float l, float offset, float r, int N, int res);
   void generateMagnets(int N, int I, float depth, float height, float radius, int res);
+  void addMagnets(const std::vector<Magnet>&);
   std::vector<float> generateTorqueRippleVector();
-  float calculateTorque();
+  std::vector<float> generateTorqueRippleVector(RotorFieldModel&);
+  float calculateTorque() const;
+  float calculateTorque(const RotorFieldModel&) const;
+  float lookupTorque();
   void update(float dt);
 
   // Set
   void setRotorAngle(float angle);
+  void setSpeed(float speed);
+  void setDamping(float damping);
+  void setLoadTorque(float load_torque);
+  void setIntegrator(Integrator);
+  void setAnalyticDipoles(bool);
+  // Follows setAnalyticDipoles and magnet changes, segment dipoles need one loop shared by all magnets.
+  // False if enabled but the magnets do not share one, the tree then stays off until they do
+  bool setDipoleTree(bool enabled, float opening_angle = 0.2);
+  void setVoltageDriven(bool);
   void setVoltages(float U, float V, float W);
   void setCurrents(float U, float V, float W);
   void setCurrentVector(cv::Vec2d);
   void setCurrentVector(float angle, float magnitude);
 
   // Get
-  float getAngle();
-  cv::Vec3d getCurrents();
-  std::vector<Coil> getCoils();
-  std::vector<Magnet> getMagnets();
-  cv::Vec3d getForceOnDipoleAtPos(Dipole);
+  float getAngle() const;
+  float getSpeed() const;
+  float getInertia() const;
+  float getDamping() const;
+  float getLoadTorque() const;
+  float getTorque() const;
+  cv::Vec3d getVoltages() const;
+  MotorState getState() const;
+  cv::Vec3d getCurrents() const;
+  cv::Vec2d getCurrentVector() const;
+  TorqueMap& getTorqueMap();
+  const TorqueMap& getTorqueMap() const;
+  PhaseModel& getPhaseModel();
+  bool isVoltageDriven() const;
+  bool isDipoleTreeActive() const;
+  ConstView<Coil> getCoils() const;
+  ConstView<Coil> getPhaseCoils(int phase) const; // 0 = U, 1 = V, 2 = W
+  const std::vector<Magnet>& getMagnets() const;
+  size_t getBytes() const; // Including heap bytes held by coils, magnets and caches
+  cv::Vec3d getForceOnDipoleAtPos(const Dipole&) const;
+  cv::Vec3d getMagnetFieldVectorAtPos(const cv::Vec3d&) const; // Always summed in double
 
   // Render
-  cv::Mat renderMotorCoils(cv::Mat& canvas);
-  cv::Mat renderMagnets(cv::Mat& canvas);
+  cv::Mat renderMotorCoils(cv::Mat& canvas) const;
+  cv::Mat renderMagnets(cv::Mat& canvas) const;
   cv::Mat renderMotor();
   cv::Mat renderCurrentVector();
 };
@@ -0,0 +1,176 @@
+// stdlib
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iomanip>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// User headers
+#include "Motor.hpp"
+#include "PhaseModel.hpp"
+#include "WireSegments.hpp"
+#include "Trace.hpp"
+
+
+
+void PhaseModel::generate(const Motor& motor){
+  // M_pq = sum over segments a of phase p of dl_a . A_q(a), A_q from phase q at unit current
+  TRACE_SCOPE("PhaseModel::generate");
+  // Coil segments of each phase at unit current
+  WireSegments phase_segments[3];
+  for(int phase = 0; phase < 3; phase++){
+    ConstView<Coil> phase_coils = motor.getPhaseCoils(phase);
+    for(int coil_num = 0; coil_num < phase_coils.size(); coil_num++){
+      phase_segments[phase].append(phase_coils[coil_num].coil_segments);
+    }
+  }
+
+  // Mutual terms, averaged over both orders so L is symmetric
+  double neumann[3][3];
+  for(int p = 0; p < 3; p++){
+    for(int q = 0; q < 3; q++){
+      const WireSegments& elements = phase_segments[p];
+      double sum = 0;
+      for(size_t a = 0; a < elements.size(); a++){
+        cv::Vec3d potential = vectorPotentialSum(phase_segments[q], cv::Vec3d(elements.pos_x[a], elements.pos_y[a], elements.pos_z[a]));
+        sum += elements.dir_x[a] * potential[0] + elements.dir_y[a] * potential[1] + elements.dir_z[a] * potential[2];
+      }
+      neumann[p][q] = sum;
+    }
+  }
+  for(int p = 0; p < 3; p++){
+    for(int q = 0; q < 3; q++){
+      inductance[p][q] = 0.5 * (neumann[p][q] + neumann[q][p]);
+    }
+  }
+
+  // Own term of each segment, external plus internal inductance of a straight round wire: 2l (ln(2l / a) - 3/4)
+  for(int p = 0; p < 3; p++){
+    const WireSegments& elements = phase_segments[p];
+    for(size_t a = 0; a < elements.size(); a++){
+      double l = sqrt(elements.dir_x[a]*elements.dir_x[a] + elements.dir_y[a]*elements.dir_y[a] + elements.dir_z[a]*elements.dir_z[a]);
+      inductance[p][p] += 2 * l * (log(2 * l / wire_radius) - 0.75);
+    }
+  }
+
+  step_dt = 0;
+  valid = true;
+}
+
+
+void PhaseModel::invalidate(){
+  valid = false;
+}
+
+
+bool PhaseModel::isValid() const {
+  return valid;
+}
+
+
+void PhaseModel::prepareStep(float dt){
+  // Inverse of A = L + dt R by cofactors
+  double a[3][3];
+  for(int p = 0; p < 3; p++){
+    for(int q = 0; q < 3; q++){
+      a[p][q] = inductance[p][q] + ((p == q) ? dt * resistance : 0);
+    }
+  }
+  double det = a[0][0] * (a[1][1]*a[2][2] - a[1][2]*a[2][1])
+             - a[0][1] * (a[1][0]*a[2][2] - a[1][2]*a[2][0])
+             + a[0][2] * (a[1][0]*a[2][1] - a[1][1]*a[2][0]);
+
+  for(int p = 0; p < 3; p++){
+    for(int q = 0; q < 3; q++){
+      // Cofactor of a[q][p], indices taken cyclically so the sign is built in
+      int r0 = (q + 1) % 3, r1 = (q + 2) % 3;
+      int c0 = (p + 1) % 3, c1 = (p + 2) % 3;
+      step_matrix[p][q] = (a[r0][c0]*a[r1][c1] - a[r0][c1]*a[r1][c0]) / det;
+    }
+  }
+
+  step_ones_sum = 0;
+  for(int p = 0; p < 3; p++){
+    step_ones[p] = step_matrix[p][0] + step_matrix[p][1] + step_matrix[p][2];
+    step_ones_sum += step_ones[p];
+  }
+  step_dt = dt;
+}
+
+
+cv::Vec3d PhaseModel::step(const cv::Vec3d& currents, const cv::Vec3d& voltages, const TorqueMap& torque_map, float rotor_angle, float speed, float dt){
+  /*
+    (L + dt R) i' = L i + dt (v - e - v_n), with the neutral voltage v_n the same on every phase.
+    With K = (L + dt R)^-1 and x = L i + dt (v - e): i' = K x - dt v_n K 1, and v_n follows from sum(i') = 0.
+   */
+  if(dt != step_dt){
+    prepareStep(dt);
+  }
+
+  cv::Vec3d back_emf = getBackEMF(torque_map, rotor_angle, speed);
+  cv::Vec3d x;
+  for(int p = 0; p < 3; p++){
+    x[p] = dt * (voltages[p] - back_emf[p]);
+    for(int q = 0; q < 3; q++){
+      x[p] += inductance[p][q] * currents[q];
+    }
+  }
+
+  cv::Vec3d next;
+  for(int p = 0; p < 3; p++){
+    next[p] = step_matrix[p][0] * x[0] + step_matrix[p][1] * x[1] + step_matrix[p][2] * x[2];
+  }
+  double neutral = (next[0] + next[1] + next[2]) / step_ones_sum;
+  return next - neutral * step_ones;
+}
+
+
+// Set methods
+void PhaseModel::setResistance(float _resistance){
+  resistance = _resistance;
+  step_dt = 0;
+}
+
+
+void PhaseModel::setWireRadius(float _wire_radius){
+  // The self inductances depend on it, Motor::update regenerates an invalid model
+  wire_radius = _wire_radius;
+  invalidate();
+}
+
+
+// Get methods
+float PhaseModel::getResistance() const {
+  return resistance;
+}
+
+
+float PhaseModel::getWireRadius() const {
+  return wire_radius;
+}
+
+
+double PhaseModel::getInductance(int phase_a, int phase_b) const {
+  return inductance[phase_a][phase_b];
+}
+
+
+cv::Vec3d PhaseModel::getTorqueConstants(const TorqueMap& torque_map, float rotor_angle) const {
+  // alpha = 2/3 u - 1/3 (v + w), beta = (v - w) / sqrt(3), so dT/di_p = T_alpha dalpha/di_p + T_beta dbeta/di_p
+  cv::Vec2f torque_vector = torque_map.getTorqueVector(rotor_angle);
+  double alpha = torque_vector[0], beta = torque_vector[1];
+  return cv::Vec3d(2.0/3.0 * alpha, -1.0/3.0 * alpha + beta / sqrt(3.0), -1.0/3.0 * alpha - beta / sqrt(3.0));
+}
+
+
+cv::Vec3d PhaseModel::getBackEMF(const TorqueMap& torque_map, float rotor_angle, float speed) const {
+  return speed * getTorqueConstants(torque_map, rotor_angle);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+// stdlib
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iomanip>
+#include <vector>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// user headers
+#include "util.hpp"
+#include "TorqueMap.hpp"
+
+
+class Motor;
+
+
+/*
+  Per phase RL circuits of the U/V/W coil groups: v = R i + L di/dt + e.
+  L is the 3x3 self and mutual inductance of the phases, the Neumann sum of dl . A over the coil segments with A = sum of I ds / r
+  (u0/4pi = 1, the units of field and torque). A segment's own term is the closed form of a straight round wire.
+  The back-EMF comes from the torque map the rotor is driven by: with T = i_alpha T_alpha(θ) + i_beta T_beta(θ),
+  each phase's torque per amp is k_p = dT/di_p through the Clarke transform, and e = ω k.
+  The power the phases lose to the back-EMF is then the mechanical power T ω, with no second flux model to disagree with the torque.
+  The coils are air cored, so L does not depend on the rotor angle.
+  Phases are star connected with a floating neutral, the currents always sum to zero.
+ */
+class PhaseModel {
+  double inductance[3][3] = {};
+  float resistance = 0.1; // Per phase
+  float wire_radius = 1; // Of the coil wire, sets the self inductance
+  bool valid = false;
+
+  // Backward Euler step matrix (L + dt R)^-1 for the last dt, and its row sums
+  float step_dt = 0;
+  double step_matrix[3][3];
+  cv::Vec3d step_ones;
+  double step_ones_sum;
+  void prepareStep(float dt);
+
+public:
+  void generate(const Motor&); // Only depends on the coils
+  void invalidate();
+  bool isValid() const;
+
+  // Advances the phase currents by dt under the phase voltages, rotor angle and speed held over the step.
+  // Backward Euler, so steps longer than L/R stay stable
+  cv::Vec3d step(const cv::Vec3d& currents, const cv::Vec3d& voltages, const TorqueMap&, float rotor_angle, float speed, float dt);
+
+  // Set
+  void setResistance(float);
+  void setWireRadius(float); // Invalidates the model
+
+  // Get
+  float getResistance() const;
+  float getWireRadius() const;
+  double getInductance(int phase_a, int phase_b) const; // 0 = U, 1 = V, 2 = W
+  cv::Vec3d getTorqueConstants(const TorqueMap&, float rotor_angle) const; // dT/di per phase
+  cv::Vec3d getBackEMF(const TorqueMap&, float rotor_angle, float speed) const;
+};
@@ -0,0 +1,156 @@
+
+// stdlib
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iomanip>
+#include <algorithm>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// User headers
+#include "RotorFieldModel.hpp"
+#include "Magnet.hpp"
+
+
+
+RotorFieldModel::RotorFieldModel(){}
+
+
+RotorFieldModel::RotorFieldModel(int _harmonics, int _rings, float _r_min, float _r_max, int _levels, float _z_min, float _z_max) :
+  harmonics(_harmonics), rings(std::max(2, _rings)), levels(std::max(1, _levels)), r_min(_r_min), r_max(_r_max), z_min(_z_min), z_max(_z_max)
+{}
+
+
+int RotorFieldModel::coefIndex(int level, int ring, int n) const {
+  return (level*rings + ring)*(harmonics + 1) + n;
+}
+
+
+void RotorFieldModel::fit(const std::vector<Magnet>& magnets, float _rotor_angle){
+  /*
+    For every ring (r, z) the field is sampled at evenly spaced angles and
+    each polar component is projected onto cos(n*phi) and sin(n*phi).
+   */
+  int samples = 4*harmonics + 4;
+  int coef_num = levels * rings * (harmonics + 1);
+
+  for(int c = 0; c < 3; c++){
+    cos_coef[c] = std::vector<double>(coef_num, 0);
+    sin_coef[c] = std::vector<double>(coef_num, 0);
+  }
+
+  std::vector<cv::Vec3d> ring_field(samples);
+
+  for(int level = 0; level < levels; level++){
+    float z = (levels > 1) ? z_min + (z_max - z_min) * level / (levels - 1) : z_min;
+
+    for(int ring = 0; ring < rings; ring++){
+      float r = r_min + (r_max - r_min) * ring / (rings - 1);
+
+      // Sample ring in polar components
+      for(int k = 0; k < samples; k++){
+        double phi = 2 * M_PI * k / samples;
+        cv::Vec3d pos(r * cos(phi), r * sin(phi), z);
+        cv::Vec3d field;
+        for(int i = 0; i < magnets.size(); i++){
+          field += magnets[i].getFieldVectorAtPos(pos);
+        }
+        ring_field[k][0] = field[0] * cos(phi) + field[1] * sin(phi);
+        ring_field[k][1] = -field[0] * sin(phi) + field[1] * cos(phi);
+        ring_field[k][2] = field[2];
+      }
+
+      // Project onto harmonics
+      for(int n = 0; n <= harmonics; n++){
+        double weight = (n == 0) ? 1.0 / samples : 2.0 / samples;
+        for(int k = 0; k < samples; k++){
+          double phi = 2 * M_PI * k / samples;
+          double cos_n = cos(n * phi);
+          double sin_n = sin(n * phi);
+          for(int c = 0; c < 3; c++){
+            cos_coef[c][coefIndex(level, ring, n)] += weight * ring_field[k][c] * cos_n;
+            sin_coef[c][coefIndex(level, ring, n)] += weight * ring_field[k][c] * sin_n;
+          }
+        }
+      }
+    }
+  }
+
+  fit_angle = _rotor_angle;
+  setRotorAngle(_rotor_angle);
+}
+
+
+bool RotorFieldModel::isFitted() const {
+  return !cos_coef[0].empty();
+}
+
+
+void RotorFieldModel::setRotorAngle(float angle){
+  rotor_angle = angle;
+  rotation = cv::Vec2d(cos(angle - fit_angle), sin(angle - fit_angle));
+}
+
+
+float RotorFieldModel::getRotorAngle() const {
+  return rotor_angle;
+}
+
+
+cv::Vec3d RotorFieldModel::getFieldVectorAtPos(const cv::Vec3d& pos) const {
+  double r = sqrt(pos[0]*pos[0] + pos[1]*pos[1]);
+  double cos_phi = (r > 0) ? pos[0] / r : 1;
+  double sin_phi = (r > 0) ? pos[1] / r : 0;
+
+  // Angle in the frame the model was fitted in
+  double cos_local = cos_phi * rotation[0] + sin_phi * rotation[1];
+  double sin_local = sin_phi * rotation[0] - cos_phi * rotation[1];
+
+  // Bilinear weights in (r, z), clamped to the fitted region
+  double ring_f = std::min<double>(std::max<double>((r - r_min) / (r_max - r_min) * (rings - 1), 0), rings - 1);
+  int ring = std::min<int>(ring_f, rings - 2);
+  double wr = ring_f - ring;
+
+  double level_f = 0;
+  if(levels > 1){
+    level_f = std::min<double>(std::max<double>((pos[2] - z_min) / (z_max - z_min) * (levels - 1), 0), levels - 1);
+  }
+  int level = std::min<int>(level_f, std::max(levels - 2, 0));
+  double wz = level_f - level;
+  int next_level = std::min(level + 1, levels - 1);
+
+  int corners[4] = {coefIndex(level, ring, 0), coefIndex(level, ring + 1, 0), coefIndex(next_level, ring, 0), coefIndex(next_level, ring + 1, 0)};
+  double weights[4] = {(1 - wr)*(1 - wz), wr*(1 - wz), (1 - wr)*wz, wr*wz};
+
+  // Sum harmonics, stepping cos(n*phi), sin(n*phi) by complex multiplication
+  cv::Vec3d polar_field(0, 0, 0);
+  double cos_n = 1, sin_n = 0;
+  for(int n = 0; n <= harmonics; n++){
+    for(int c = 0; c < 3; c++){
+      double a = 0, b = 0;
+      for(int k = 0; k < 4; k++){
+        a += weights[k] * cos_coef[c][corners[k] + n];
+        b += weights[k] * sin_coef[c][corners[k] + n];
+      }
+      polar_field[c] += a * cos_n + b * sin_n;
+    }
+    double cos_next = cos_n * cos_local - sin_n * sin_local;
+    sin_n = sin_n * cos_local + cos_n * sin_local;
+    cos_n = cos_next;
+  }
+
+  // Back to cartesian components
+  return cv::Vec3d(
+    polar_field[0] * cos_phi - polar_field[1] * sin_phi,
+    polar_field[0] * sin_phi + polar_field[1] * cos_phi,
+    polar_field[2]
+  );
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+// stdlib
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iomanip>
+#include <vector>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// user headers
+#include "util.hpp"
+#include "Dipole.hpp"
+#include "Magnet.hpp"
+
+
+
+/*
+  Angular harmonic expansion of the rotor field on a cylindrical (r, z) grid.
+  The field is stored in polar components (B_r, B_phi, B_z), which do not change when the rotor turns,
+  so the field at any rotor angle is the fitted field with every harmonic phase shifted by the angle.
+  Between rings and z-levels the harmonic coefficients are interpolated linearly.
+ */
+class RotorFieldModel {
+  int harmonics = 0;
+  int rings = 0;
+  int levels = 0;
+  float r_min = 0;
+  float r_max = 0;
+  float z_min = 0;
+  float z_max = 0;
+  float fit_angle = 0;
+  float rotor_angle = 0;
+  cv::Vec2d rotation = cv::Vec2d(1, 0); // cos, sin of (rotor_angle - fit_angle)
+
+  // [component][(level*rings + ring)*(harmonics + 1) + n]
+  std::vector<double> cos_coef[3];
+  std::vector<double> sin_coef[3];
+
+  int coefIndex(int level, int ring, int n) const;
+
+public:
+  RotorFieldModel();
+  RotorFieldModel(int harmonics, int rings, float r_min, float r_max, int levels, float z_min, float z_max);
+
+  void fit(const std::vector<Magnet>& magnets, float rotor_angle);
+  bool isFitted() const;
+
+  void setRotorAngle(float angle);
+  float getRotorAngle() const;
+  cv::Vec3d getFieldVectorAtPos(const cv::Vec3d& pos) const;
+};
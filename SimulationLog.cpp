@@ -0,0 +1,305 @@
+
+// stdlib
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// User headers
+#include "SimulationLog.hpp"
+
+#define LOG_FILE_MAGIC "MLOG"
+#define LOG_CHUNK_MAGIC "CHNK"
+#define LOG_VERSION 1
+#define LOG_HEADER_SIZE 16
+#define LOG_CHUNK_HEADER_SIZE 8
+
+
+
+SimulationLog::SimulationLog(){}
+
+
+SimulationLog::~SimulationLog(){
+  close();
+}
+
+
+bool SimulationLog::open(const std::string& path, size_t _chunk_samples, size_t ring_samples){
+  close();
+
+  file = fopen(path.c_str(), "wb");
+  if(!file){
+    std::cout << "Could not open " << path << std::endl;
+    return false;
+  }
+
+  uint32_t header[3] = {LOG_VERSION, LOG_COLUMN_NUM, 0};
+  fwrite(LOG_FILE_MAGIC, 1, 4, file);
+  fwrite(header, sizeof(uint32_t), 3, file);
+
+  // Ring size rounded up to a power of two so slots are found by masking
+  size_t capacity = 1;
+  while(capacity < ring_samples){
+    capacity <<= 1;
+  }
+  ring = std::vector<LogSample>(capacity);
+  ring_mask = capacity - 1;
+  chunk_samples = std::max<size_t>(1, _chunk_samples);
+  head = 0;
+  tail = 0;
+  stopping = false;
+  record_count = 0;
+  stall_count = 0;
+
+  writer = std::thread(&SimulationLog::writeLoop, this);
+  return true;
+}
+
+
+void SimulationLog::close(){
+  if(!file){
+    return;
+  }
+  stopping.store(true, std::memory_order_release);
+  writer.join();
+  fclose(file);
+  file = nullptr;
+  ring = std::vector<LogSample>();
+  ring_mask = 0;
+}
+
+
+bool SimulationLog::isOpen() const {
+  return file != nullptr;
+}
+
+
+void SimulationLog::record(double time, const MotorState& state, const Controller& controller){
+  // Not open, or closed already, there is no ring and no writer to drain it
+  if(!file){
+    return;
+  }
+  if(record_count++ % decimation != 0){
+    return;
+  }
+
+  size_t h = head.load(std::memory_order_relaxed);
+  if(h - tail.load(std::memory_order_acquire) > ring_mask){
+    stall_count++;
+    while(h - tail.load(std::memory_order_acquire) > ring_mask){
+      std::this_thread::yield();
+    }
+  }
+
+  LogSample& sample = ring[h & ring_mask];
+  cv::Vec2d current_reference = controller.getCurrentReference();
+  cv::Vec2d voltage_command = controller.getVoltageCommand();
+  sample.time = time;
+  sample.values[LOG_ANGLE] = state.angle;
+  sample.values[LOG_SPEED] = state.speed;
+  sample.values[LOG_TORQUE] = state.torque;
+  sample.values[LOG_CURRENT_U] = state.currents[0];
+  sample.values[LOG_CURRENT_V] = state.currents[1];
+  sample.values[LOG_CURRENT_W] = state.currents[2];
+  sample.values[LOG_CURRENT_D_REFERENCE] = current_reference[0];
+  sample.values[LOG_CURRENT_Q_REFERENCE] = current_reference[1];
+  sample.values[LOG_VOLTAGE_D] = voltage_command[0];
+  sample.values[LOG_VOLTAGE_Q] = voltage_command[1];
+  head.store(h + 1, std::memory_order_release);
+}
+
+
+void SimulationLog::writeLoop(){
+  // Column buffers for one chunk, written out whenever they fill up and once more on close
+  std::vector<double> time(chunk_samples);
+  std::vector<float> columns[LOG_COLUMN_NUM];
+  for(int c = 0; c < LOG_COLUMN_NUM; c++){
+    columns[c] = std::vector<float>(chunk_samples);
+  }
+  size_t filled = 0;
+
+  while(true){
+    // Read stopping before head, so every sample recorded before close() is seen
+    bool stop = stopping.load(std::memory_order_acquire);
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_acquire);
+
+    if(h == t){
+      if(stop){
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+      continue;
+    }
+
+    size_t n = std::min(h - t, chunk_samples - filled);
+    for(size_t i = 0; i < n; i++){
+      const LogSample& sample = ring[(t + i) & ring_mask];
+      time[filled + i] = sample.time;
+      for(int c = 0; c < LOG_COLUMN_NUM; c++){
+        columns[c][filled + i] = sample.values[c];
+      }
+    }
+    tail.store(t + n, std::memory_order_release);
+    filled += n;
+
+    if(filled == chunk_samples){
+      writeChunk(time, columns, filled);
+      filled = 0;
+    }
+  }
+
+  if(filled > 0){
+    writeChunk(time, columns, filled);
+  }
+}
+
+
+void SimulationLog::writeChunk(const std::vector<double>& time, const std::vector<float>* columns, size_t n){
+  uint32_t count = n;
+  fwrite(LOG_CHUNK_MAGIC, 1, 4, file);
+  fwrite(&count, sizeof(uint32_t), 1, file);
+  fwrite(time.data(), sizeof(double), n, file);
+  for(int c = 0; c < LOG_COLUMN_NUM; c++){
+    fwrite(columns[c].data(), sizeof(float), n, file);
+  }
+}
+
+
+void SimulationLog::setDecimation(int _decimation){
+  decimation = std::max(1, _decimation);
+}
+
+
+long SimulationLog::getStallCount() const {
+  return stall_count;
+}
+
+
+
+SimulationLogReader::SimulationLogReader(){}
+
+
+SimulationLogReader::~SimulationLogReader(){
+  close();
+}
+
+
+bool SimulationLogReader::open(const std::string& path){
+  close();
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if(fd < 0){
+    std::cout << "Could not open " << path << std::endl;
+    return false;
+  }
+  struct stat file_stat;
+  fstat(fd, &file_stat);
+  file_size = file_stat.st_size;
+  if(file_size < LOG_HEADER_SIZE){
+    ::close(fd);
+    std::cout << "Not a simulation log " << path << std::endl;
+    return false;
+  }
+
+  void* mapped = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if(mapped == MAP_FAILED){
+    std::cout << "Could not map " << path << std::endl;
+    return false;
+  }
+  data = (const unsigned char*)mapped;
+
+  uint32_t column_num;
+  memcpy(&column_num, data + 8, 4);
+  if(memcmp(data, LOG_FILE_MAGIC, 4) != 0 || column_num != LOG_COLUMN_NUM){
+    std::cout << "Not a simulation log " << path << std::endl;
+    close();
+    return false;
+  }
+
+  // Index chunks, a truncated last chunk from an interrupted run is ignored
+  size_t offset = LOG_HEADER_SIZE;
+  while(offset + LOG_CHUNK_HEADER_SIZE <= file_size && memcmp(data + offset, LOG_CHUNK_MAGIC, 4) == 0){
+    uint32_t count;
+    memcpy(&count, data + offset + 4, 4);
+    size_t chunk_bytes = LOG_CHUNK_HEADER_SIZE + count * (sizeof(double) + LOG_COLUMN_NUM * sizeof(float));
+    if(offset + chunk_bytes > file_size){
+      break;
+    }
+    chunk_offsets.push_back(offset);
+    chunk_sizes.push_back(count);
+    chunk_first.push_back(sample_num);
+    sample_num += count;
+    offset += chunk_bytes;
+  }
+  return true;
+}
+
+
+void SimulationLogReader::close(){
+  if(data){
+    munmap((void*)data, file_size);
+  }
+  data = nullptr;
+  file_size = 0;
+  sample_num = 0;
+  chunk_offsets.clear();
+  chunk_sizes.clear();
+  chunk_first.clear();
+}
+
+
+size_t SimulationLogReader::size() const {
+  return sample_num;
+}
+
+
+size_t SimulationLogReader::getChunkCount() const {
+  return chunk_offsets.size();
+}
+
+
+size_t SimulationLogReader::getChunkSize(size_t chunk) const {
+  return chunk_sizes[chunk];
+}
+
+
+const double* SimulationLogReader::getChunkTime(size_t chunk) const {
+  return (const double*)(data + chunk_offsets[chunk] + LOG_CHUNK_HEADER_SIZE);
+}
+
+
+const float* SimulationLogReader::getChunkColumn(size_t chunk, LogColumn column) const {
+  const unsigned char* values = data + chunk_offsets[chunk] + LOG_CHUNK_HEADER_SIZE + chunk_sizes[chunk] * sizeof(double);
+  return (const float*)values + column * chunk_sizes[chunk];
+}
+
+
+double SimulationLogReader::getTime(size_t sample) const {
+  size_t chunk = std::upper_bound(chunk_first.begin(), chunk_first.end(), sample) - chunk_first.begin() - 1;
+  return getChunkTime(chunk)[sample - chunk_first[chunk]];
+}
+
+
+float SimulationLogReader::getValue(size_t sample, LogColumn column) const {
+  size_t chunk = std::upper_bound(chunk_first.begin(), chunk_first.end(), sample) - chunk_first.begin() - 1;
+  return getChunkColumn(chunk, column)[sample - chunk_first[chunk]];
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+// stdlib
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// user headers
+#include "util.hpp"
+#include "Motor.hpp"
+#include "Controller.hpp"
+
+
+// Float columns stored after the time column, in file order
+enum LogColumn {
+  LOG_ANGLE,
+  LOG_SPEED,
+  LOG_TORQUE,
+  LOG_CURRENT_U,
+  LOG_CURRENT_V,
+  LOG_CURRENT_W,
+  LOG_CURRENT_D_REFERENCE,
+  LOG_CURRENT_Q_REFERENCE,
+  LOG_VOLTAGE_D,
+  LOG_VOLTAGE_Q,
+  LOG_COLUMN_NUM
+};
+
+
+struct LogSample {
+  double time;
+  float values[LOG_COLUMN_NUM];
+};
+
+
+/*
+  Append only, chunked, columnar binary log of simulation state.
+  record() copies a sample into a single producer single consumer ring buffer and returns; it only waits when the ring is full.
+  A background thread drains the ring, transposes full chunks into columns and appends them to the file.
+
+  File:  "MLOG", uint32 version, uint32 column count, uint32 reserved
+  Chunk: "CHNK", uint32 sample count n, float64 time[n], then float32 values[n] per LogColumn
+ */
+class SimulationLog {
+  std::vector<LogSample> ring;
+  size_t ring_mask = 0;
+  alignas(64) std::atomic<size_t> head{0}; // Next slot the producer writes
+  alignas(64) std::atomic<size_t> tail{0}; // Next slot the writer reads
+  alignas(64) std::atomic<bool> stopping{false};
+  size_t chunk_samples = 0;
+  int decimation = 1;
+  long record_count = 0;
+  long stall_count = 0;
+  FILE* file = nullptr;
+  std::thread writer;
+
+  void writeLoop();
+  void writeChunk(const std::vector<double>& time, const std::vector<float>* columns, size_t n);
+
+public:
+  SimulationLog();
+  ~SimulationLog();
+  SimulationLog(const SimulationLog&) = delete;
+  SimulationLog& operator=(const SimulationLog&) = delete;
+
+  bool open(const std::string& path, size_t chunk_samples = 4096, size_t ring_samples = 1 << 16);
+  void close(); // Writes the samples still queued
+  bool isOpen() const;
+  void record(double time, const MotorState&, const Controller&); // Ignored unless open
+
+  // Set
+  void setDecimation(int); // Keep every n-th recorded sample
+
+  // Get
+  long getStallCount() const; // Samples that had to wait for the writer
+};
+
+
+/*
+  Memory maps a log written by SimulationLog, columns are read in place without copying.
+ */
+class SimulationLogReader {
+  const unsigned char* data = nullptr;
+  size_t file_size = 0;
+  std::vector<size_t> chunk_offsets;
+  std::vector<size_t> chunk_sizes;
+  std::vector<size_t> chunk_first; // Index of the first sample of each chunk
+  size_t sample_num = 0;
+
+public:
+  SimulationLogReader();
+  ~SimulationLogReader();
+  SimulationLogReader(const SimulationLogReader&) = delete;
+  SimulationLogReader& operator=(const SimulationLogReader&) = delete;
+
+  bool open(const std::string& path);
+  void close();
+
+  size_t size() const;
+  size_t getChunkCount() const;
+  size_t getChunkSize(size_t chunk) const;
+  const double* getChunkTime(size_t chunk) const;
+  const float* getChunkColumn(size_t chunk, LogColumn) const;
+
+  double getTime(size_t sample) const;
+  float getValue(size_t sample, LogColumn) const;
+};
@@ -0,0 +1,165 @@
+
+// stdlib
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iomanip>
+#include <algorithm>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// User headers
+#include "Motor.hpp"
+#include "TorqueMap.hpp"
+#include "RotorFieldModel.hpp"
+#include "Trace.hpp"
+
+
+
+// Torque for a unit alpha and a unit beta current at given rotor angle
+cv::Vec2f TorqueMap::sampleTorque(Motor& motor, RotorFieldModel* rotor_model, float rotor_angle){
+  cv::Vec2f torque;
+
+  if(rotor_model){
+    rotor_model->setRotorAngle(rotor_angle);
+  }else{
+    motor.setRotorAngle(rotor_angle);
+  }
+
+  for(int axis = 0; axis < 2; axis++){
+    motor.setCurrentVector(cv::Vec2d(axis == 0, axis == 1));
+    torque[axis] = rotor_model ? motor.calculateTorque(*rotor_model) : motor.calculateTorque();
+  }
+  return torque;
+}
+
+
+void TorqueMap::refine(Motor& motor, RotorFieldModel* rotor_model, float a, cv::Vec2f t_a, float b, cv::Vec2f t_b, float tolerance, int depth){
+  // Nodes are appended in order: a is already stored, b is stored by the caller
+  if(depth <= 0){
+    return;
+  }
+
+  float m = (a + b) / 2;
+  cv::Vec2f t_m = sampleTorque(motor, rotor_model, m);
+  cv::Vec2f error = t_m - (t_a + t_b) * 0.5;
+
+  if(std::max(fabs(error[0]), fabs(error[1])) <= tolerance){
+    return;
+  }
+
+  refine(motor, rotor_model, a, t_a, m, t_m, tolerance, depth - 1);
+  angles.push_back(m);
+  torque_alpha.push_back(t_m[0]);
+  torque_beta.push_back(t_m[1]);
+  refine(motor, rotor_model, m, t_m, b, t_b, tolerance, depth - 1);
+}
+
+
+void TorqueMap::generate(Motor& motor, float tolerance, int initial_samples, int max_depth){
+  generate(motor, nullptr, tolerance, initial_samples, max_depth);
+}
+
+
+void TorqueMap::generate(Motor& motor, RotorFieldModel& rotor_model, float tolerance, int initial_samples, int max_depth){
+  generate(motor, &rotor_model, tolerance, initial_samples, max_depth);
+}
+
+
+void TorqueMap::generate(Motor& motor, RotorFieldModel* rotor_model, float tolerance, int initial_samples, int max_depth){
+  /*
+    tolerance is relative to the largest torque seen on the uniform pass.
+    The motor's rotor angle and current vector are restored afterwards.
+   */
+  TRACE_SCOPE("TorqueMap::generate");
+  float saved_angle = rotor_model ? rotor_model->getRotorAngle() : motor.getAngle();
+  cv::Vec2d saved_current_vector = motor.getCurrentVector();
+
+  std::vector<cv::Vec2f> uniform(initial_samples);
+  float peak = 0;
+  for(int i = 0; i < initial_samples; i++){
+    uniform[i] = sampleTorque(motor, rotor_model, 2 * M_PI * i / initial_samples);
+    peak = std::max<float>(peak, std::max(fabs(uniform[i][0]), fabs(uniform[i][1])));
+  }
+
+  angles.clear();
+  torque_alpha.clear();
+  torque_beta.clear();
+
+  for(int i = 0; i < initial_samples; i++){
+    float a = 2 * M_PI * i / initial_samples;
+    float b = 2 * M_PI * (i + 1) / initial_samples;
+    cv::Vec2f t_b = uniform[(i + 1) % initial_samples];
+
+    angles.push_back(a);
+    torque_alpha.push_back(uniform[i][0]);
+    torque_beta.push_back(uniform[i][1]);
+    refine(motor, rotor_model, a, uniform[i], b, t_b, tolerance * peak, max_depth);
+  }
+  angles.push_back(2 * M_PI);
+  torque_alpha.push_back(uniform[0][0]);
+  torque_beta.push_back(uniform[0][1]);
+
+  if(rotor_model){
+    rotor_model->setRotorAngle(saved_angle);
+  }else{
+    motor.setRotorAngle(saved_angle);
+  }
+  motor.setCurrentVector(saved_current_vector);
+  valid = true;
+}
+
+
+void TorqueMap::invalidate(){
+  valid = false;
+}
+
+
+bool TorqueMap::isValid() const {
+  return valid;
+}
+
+
+int TorqueMap::getSampleCount() const {
+  return angles.size();
+}
+
+
+size_t TorqueMap::getBytes() const {
+  return (angles.capacity() + torque_alpha.capacity() + torque_beta.capacity()) * sizeof(float);
+}
+
+
+cv::Vec2f TorqueMap::getTorqueVector(float rotor_angle) const {
+  float theta = fmod(rotor_angle, float(2 * M_PI));
+  if(theta < 0){
+    theta += 2 * M_PI;
+  }
+
+  int i = std::upper_bound(angles.begin(), angles.end(), theta) - angles.begin() - 1;
+  i = std::min<int>(std::max(i, 0), angles.size() - 2);
+  float w = (theta - angles[i]) / (angles[i + 1] - angles[i]);
+
+  return cv::Vec2f(
+    torque_alpha[i] + w * (torque_alpha[i + 1] - torque_alpha[i]),
+    torque_beta[i] + w * (torque_beta[i + 1] - torque_beta[i])
+  );
+}
+
+
+float TorqueMap::getTorque(float rotor_angle, cv::Vec2d current_vector) const {
+  cv::Vec2f torque_vector = getTorqueVector(rotor_angle);
+  return current_vector[0] * torque_vector[0] + current_vector[1] * torque_vector[1];
+}
+
+
+float TorqueMap::getTorque(float rotor_angle, float current_angle, float magnitude) const {
+  return getTorque(rotor_angle, cv::Vec2d(cos(current_angle) * magnitude, sin(current_angle) * magnitude));
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+// stdlib
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iomanip>
+#include <vector>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// user headers
+#include "util.hpp"
+
+
+class Motor;
+class RotorFieldModel;
+
+
+/*
+  Cached torque over rotor angle and current vector.
+  Torque is linear in the alpha-beta current, so per rotor angle the torque of a unit alpha and a unit beta current is stored,
+  and T(theta, i) = i_alpha * T_alpha(theta) + i_beta * T_beta(theta) holds for any current angle and magnitude.
+  Rotor angles are sampled uniformly and then bisected where linear interpolation misses the midpoint by more than the tolerance.
+ */
+class TorqueMap {
+  std::vector<float> angles; // Sorted in [0, 2pi], last node wraps to the first
+  std::vector<float> torque_alpha;
+  std::vector<float> torque_beta;
+  bool valid = false;
+
+  cv::Vec2f sampleTorque(Motor&, RotorFieldModel*, float rotor_angle);
+  void refine(Motor&, RotorFieldModel*, float a, cv::Vec2f t_a, float b, cv::Vec2f t_b, float tolerance, int depth);
+  void generate(Motor&, RotorFieldModel*, float tolerance, int initial_samples, int max_depth);
+
+public:
+  void generate(Motor&, float tolerance = 0.01, int initial_samples = 64, int max_depth = 6);
+  void generate(Motor&, RotorFieldModel&, float tolerance = 0.01, int initial_samples = 64, int max_depth = 6);
+  void invalidate();
+  bool isValid() const;
+  int getSampleCount() const;
+  size_t getBytes() const; // Heap bytes held
+
+  cv::Vec2f getTorqueVector(float rotor_angle) const; // Torque per unit alpha and per unit beta current
+  float getTorque(float rotor_angle, cv::Vec2d current_vector) const;
+  float getTorque(float rotor_angle, float current_angle, float magnitude) const;
+};
@@ -0,0 +1,258 @@
+// stdlib
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// User headers
+#include "Trace.hpp"
+
+// Events per thread ring buffer
+#define TRACE_BUFFER_EVENTS 16384
+
+
+
+static const char* counter_names[TRACE_COUNTER_NUM] = {"interactions", "segments_allocated", "dipoles_allocated"};
+
+
+const char* Trace::getCounterName(TraceCounter counter){
+  return counter_names[counter];
+}
+
+
+#ifdef MOTOR_TRACE
+
+struct TraceEvent {
+  const char* name;
+  uint64_t start_ns;
+  uint64_t duration_ns;
+  double value;
+  bool is_value; // Counter event instead of a timed scope
+};
+
+
+struct TraceBuffer {
+  int tid;
+  std::vector<TraceEvent> events = std::vector<TraceEvent>(TRACE_BUFFER_EVENTS);
+  uint64_t written = 0; // Total events recorded, the ring position is written % TRACE_BUFFER_EVENTS
+  // Only the owning thread adds, atomics so totals can be read from other threads
+  std::atomic<uint64_t> counters[TRACE_COUNTER_NUM] = {};
+
+  void push(const TraceEvent& event){
+    events[written % TRACE_BUFFER_EVENTS] = event;
+    written++;
+  }
+};
+
+
+// All buffers ever created, and the ones whose thread has exited
+static std::mutex registry_mutex;
+static std::vector<std::unique_ptr<TraceBuffer>> buffers;
+static std::vector<TraceBuffer*> free_buffers;
+static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+
+// Hands the thread's buffer back for reuse when the thread exits
+struct TraceThread {
+  TraceBuffer* buffer = nullptr;
+  ~TraceThread(){
+    if(buffer){
+      std::lock_guard<std::mutex> lock(registry_mutex);
+      free_buffers.push_back(buffer);
+    }
+  }
+};
+
+
+static TraceBuffer& threadBuffer(){
+  thread_local TraceThread thread;
+  if(!thread.buffer){
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    if(!free_buffers.empty()){
+      thread.buffer = free_buffers.back();
+      free_buffers.pop_back();
+    }else{
+      buffers.emplace_back(new TraceBuffer());
+      buffers.back()->tid = buffers.size();
+      thread.buffer = buffers.back().get();
+    }
+  }
+  return *thread.buffer;
+}
+
+
+bool Trace::isEnabled(){
+  return true;
+}
+
+
+uint64_t Trace::now(){
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+
+void Trace::count(TraceCounter counter, uint64_t n){
+  std::atomic<uint64_t>& total = threadBuffer().counters[counter];
+  total.store(total.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+
+void Trace::value(const char* name, double value){
+  threadBuffer().push({name, now(), 0, value, true});
+}
+
+
+void Trace::complete(const char* name, uint64_t start_ns, uint64_t end_ns){
+  threadBuffer().push({name, start_ns, end_ns - start_ns, 0, false});
+}
+
+
+uint64_t Trace::getCounter(TraceCounter counter){
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  uint64_t total = 0;
+  for(int i = 0; i < buffers.size(); i++){
+    total += buffers[i]->counters[counter].load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+
+uint64_t Trace::getDroppedEvents(){
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  uint64_t dropped = 0;
+  for(int i = 0; i < buffers.size(); i++){
+    if(buffers[i]->written > TRACE_BUFFER_EVENTS){
+      dropped += buffers[i]->written - TRACE_BUFFER_EVENTS;
+    }
+  }
+  return dropped;
+}
+
+
+void Trace::reset(){
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  for(int i = 0; i < buffers.size(); i++){
+    buffers[i]->written = 0;
+    for(int c = 0; c < TRACE_COUNTER_NUM; c++){
+      buffers[i]->counters[c].store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+
+bool Trace::writeChromeTrace(const std::string& path){
+  /*
+    JSON object format: {"traceEvents": [...], "otherData": {...}}
+    Scopes are complete ("X") events and values are counter ("C") events, times in microseconds.
+    Counter totals are added as counter events at the end of the trace and listed in otherData.
+   */
+  uint64_t counters[TRACE_COUNTER_NUM];
+  for(int c = 0; c < TRACE_COUNTER_NUM; c++){
+    counters[c] = getCounter(TraceCounter(c));
+  }
+  uint64_t dropped = getDroppedEvents();
+
+  std::ofstream file(path);
+  if(!file){
+    std::cout << "Could not open " << path << std::endl;
+    return false;
+  }
+  file << std::fixed << std::setprecision(3);
+  file << "{\"traceEvents\":[" << std::endl;
+
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  uint64_t end_ns = 0;
+  bool first = true;
+  for(int i = 0; i < buffers.size(); i++){
+    const TraceBuffer& buffer = *buffers[i];
+    uint64_t begin = buffer.written > TRACE_BUFFER_EVENTS ? buffer.written - TRACE_BUFFER_EVENTS : 0;
+
+    for(uint64_t n = begin; n < buffer.written; n++){
+      const TraceEvent& event = buffer.events[n % TRACE_BUFFER_EVENTS];
+      file << (first ? "" : ",\n");
+      first = false;
+      if(event.is_value){
+        file << "{\"name\":\"" << event.name << "\",\"ph\":\"C\",\"pid\":0,\"tid\":" << buffer.tid << ",\"ts\":" << event.start_ns * 1e-3 << ",\"args\":{\"value\":" << event.value << "}}";
+      }else{
+        file << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << buffer.tid << ",\"ts\":" << event.start_ns * 1e-3 << ",\"dur\":" << event.duration_ns * 1e-3 << "}";
+      }
+      end_ns = std::max(end_ns, event.start_ns + event.duration_ns);
+    }
+  }
+  for(int c = 0; c < TRACE_COUNTER_NUM; c++){
+    file << (first ? "" : ",\n");
+    first = false;
+    file << "{\"name\":\"" << counter_names[c] << "\",\"ph\":\"C\",\"pid\":0,\"tid\":0,\"ts\":" << end_ns * 1e-3 << ",\"args\":{\"value\":" << counters[c] << "}}";
+  }
+
+  file << std::endl << "],\"otherData\":{";
+  for(int c = 0; c < TRACE_COUNTER_NUM; c++){
+    file << "\"" << counter_names[c] << "\":" << counters[c] << ",";
+  }
+  file << "\"dropped_events\":" << dropped << "}}" << std::endl;
+
+  if(!file){
+    std::cout << "Could not write " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+
+#else
+
+// Without MOTOR_TRACE nothing is recorded
+
+
+bool Trace::isEnabled(){
+  return false;
+}
+
+
+uint64_t Trace::now(){
+  return 0;
+}
+
+
+void Trace::count(TraceCounter, uint64_t){}
+
+
+void Trace::value(const char*, double){}
+
+
+void Trace::complete(const char*, uint64_t, uint64_t){}
+
+
+uint64_t Trace::getCounter(TraceCounter){
+  return 0;
+}
+
+
+uint64_t Trace::getDroppedEvents(){
+  return 0;
+}
+
+
+void Trace::reset(){}
+
+
+bool Trace::writeChromeTrace(const std::string& path){
+  std::cout << "Tracing is disabled, build with make TRACE=1 to write " << path << std::endl;
+  return false;
+}
+
+#endif
@@ -0,0 +1,91 @@
+#pragma once
+
+// stdlib
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iomanip>
+#include <string>
+#include <cstdint>
+#include <chrono>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// user headers
+#include "util.hpp"
+
+
+
+/*
+  Scoped timers and counters for the hot paths, exported as Chrome trace-event JSON (chrome://tracing, Perfetto).
+  Only built with MOTOR_TRACE defined (make TRACE=1). Otherwise the macros below expand to nothing and their
+  arguments are never evaluated, so instrumentation can stay in release code.
+
+  Every thread records into its own ring buffer, the oldest events are overwritten when it is full.
+  Buffers of finished threads are kept and handed to the next new thread, so short lived workers do not add up.
+  Event names must be string literals, only the pointer is stored.
+ */
+
+
+enum TraceCounter {
+  TRACE_INTERACTIONS, // Source-target evaluations, e.g. one wire segment at one field point
+  TRACE_SEGMENTS_ALLOCATED, // Wire segments generated for coils and dipoles
+  TRACE_DIPOLES_ALLOCATED, // Dipoles generated for magnets
+  TRACE_COUNTER_NUM
+};
+
+
+#ifdef MOTOR_TRACE
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+// Times the rest of the enclosing block
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+// Adds n to a TraceCounter
+#define TRACE_COUNT(counter, n) Trace::count(counter, n)
+// Records a named value over time, e.g. bytes held
+#define TRACE_VALUE(name, x) Trace::value(name, x)
+#else
+#define TRACE_SCOPE(name) do{}while(0)
+#define TRACE_COUNT(counter, n) do{}while(0)
+#define TRACE_VALUE(name, x) do{}while(0)
+#endif
+
+
+class Trace {
+public:
+  static bool isEnabled();
+
+  static void count(TraceCounter, uint64_t n);
+  static void value(const char* name, double value);
+  static void complete(const char* name, uint64_t start_ns, uint64_t end_ns);
+  static uint64_t now();
+
+  // Sum over all threads
+  static uint64_t getCounter(TraceCounter);
+  static const char* getCounterName(TraceCounter);
+  static uint64_t getDroppedEvents();
+
+  // Both expect no traced work to be running
+  static void reset();
+  static bool writeChromeTrace(const std::string& path);
+};
+
+
+#ifdef MOTOR_TRACE
+class TraceScope {
+  const char* name;
+  uint64_t start;
+public:
+  TraceScope(const char* _name) : name(_name), start(Trace::now()) {}
+  ~TraceScope(){ Trace::complete(name, start, Trace::now()); }
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+};
+#endif
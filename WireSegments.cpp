@@ -0,0 +1,563 @@
+
+// stdlib
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iomanip>
+#include <immintrin.h>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// User headers
+#include "WireSegments.hpp"
+#include "Trace.hpp"
+
+
+
+// dB = ds x r / |r|^3, which is ds x r_hat / r^2 without the extra divide. Each term is formed in T and summed in A
+template <typename T, typename A> cv::Vec3d biotSavartSumScalar(const WireSegmentsT<T>& s, const cv::Vec3d& p, size_t start){
+  A bx = 0, by = 0, bz = 0;
+  T px = p[0], py = p[1], pz = p[2];
+  size_t n = s.size();
+
+  for(size_t i = start; i < n; i++){
+    T rx = px - s.pos_x[i];
+    T ry = py - s.pos_y[i];
+    T rz = pz - s.pos_z[i];
+    T r2 = rx*rx + ry*ry + rz*rz;
+    T inv_r3 = T(1) / (r2 * std::sqrt(r2));
+
+    bx += A((s.dir_y[i]*rz - s.dir_z[i]*ry) * inv_r3);
+    by += A((s.dir_z[i]*rx - s.dir_x[i]*rz) * inv_r3);
+    bz += A((s.dir_x[i]*ry - s.dir_y[i]*rx) * inv_r3);
+  }
+
+  return cv::Vec3d(bx, by, bz);
+}
+
+
+__attribute__((target("avx2,fma")))
+static cv::Vec3d biotSavartSumAVX2(const WireSegments& s, const cv::Vec3d& p){
+  const size_t lanes = 4;
+  size_t n = s.size() - s.size() % lanes;
+
+  __m256d px = _mm256_set1_pd(p[0]);
+  __m256d py = _mm256_set1_pd(p[1]);
+  __m256d pz = _mm256_set1_pd(p[2]);
+  __m256d one = _mm256_set1_pd(1.0);
+  __m256d bx = _mm256_setzero_pd();
+  __m256d by = _mm256_setzero_pd();
+  __m256d bz = _mm256_setzero_pd();
+
+  for(size_t i = 0; i < n; i += lanes){
+    __m256d rx = _mm256_sub_pd(px, _mm256_load_pd(&s.pos_x[i]));
+    __m256d ry = _mm256_sub_pd(py, _mm256_load_pd(&s.pos_y[i]));
+    __m256d rz = _mm256_sub_pd(pz, _mm256_load_pd(&s.pos_z[i]));
+    __m256d dx = _mm256_load_pd(&s.dir_x[i]);
+    __m256d dy = _mm256_load_pd(&s.dir_y[i]);
+    __m256d dz = _mm256_load_pd(&s.dir_z[i]);
+
+    __m256d r2 = _mm256_fmadd_pd(rx, rx, _mm256_fmadd_pd(ry, ry, _mm256_mul_pd(rz, rz)));
+    __m256d inv_r3 = _mm256_div_pd(one, _mm256_mul_pd(r2, _mm256_sqrt_pd(r2)));
+
+    bx = _mm256_fmadd_pd(_mm256_fmsub_pd(dy, rz, _mm256_mul_pd(dz, ry)), inv_r3, bx);
+    by = _mm256_fmadd_pd(_mm256_fmsub_pd(dz, rx, _mm256_mul_pd(dx, rz)), inv_r3, by);
+    bz = _mm256_fmadd_pd(_mm256_fmsub_pd(dx, ry, _mm256_mul_pd(dy, rx)), inv_r3, bz);
+  }
+
+  alignas(32) double sx[lanes], sy[lanes], sz[lanes];
+  _mm256_store_pd(sx, bx);
+  _mm256_store_pd(sy, by);
+  _mm256_store_pd(sz, bz);
+
+  cv::Vec3d field = biotSavartSumScalar<double, double>(s, p, n);
+  for(size_t k = 0; k < lanes; k++){
+    field += cv::Vec3d(sx[k], sy[k], sz[k]);
+  }
+  return field;
+}
+
+
+__attribute__((target("avx512f")))
+static cv::Vec3d biotSavartSumAVX512(const WireSegments& s, const cv::Vec3d& p){
+  const size_t lanes = 8;
+  size_t n = s.size() - s.size() % lanes;
+
+  __m512d px = _mm512_set1_pd(p[0]);
+  __m512d py = _mm512_set1_pd(p[1]);
+  __m512d pz = _mm512_set1_pd(p[2]);
+  __m512d one = _mm512_set1_pd(1.0);
+  __m512d bx = _mm512_setzero_pd();
+  __m512d by = _mm512_setzero_pd();
+  __m512d bz = _mm512_setzero_pd();
+
+  for(size_t i = 0; i < n; i += lanes){
+    __m512d rx = _mm512_sub_pd(px, _mm512_load_pd(&s.pos_x[i]));
+    __m512d ry = _mm512_sub_pd(py, _mm512_load_pd(&s.pos_y[i]));
+    __m512d rz = _mm512_sub_pd(pz, _mm512_load_pd(&s.pos_z[i]));
+    __m512d dx = _mm512_load_pd(&s.dir_x[i]);
+    __m512d dy = _mm512_load_pd(&s.dir_y[i]);
+    __m512d dz = _mm512_load_pd(&s.dir_z[i]);
+
+    __m512d r2 = _mm512_fmadd_pd(rx, rx, _mm512_fmadd_pd(ry, ry, _mm512_mul_pd(rz, rz)));
+    __m512d inv_r3 = _mm512_div_pd(one, _mm512_mul_pd(r2, _mm512_sqrt_pd(r2)));
+
+    bx = _mm512_fmadd_pd(_mm512_fmsub_pd(dy, rz, _mm512_mul_pd(dz, ry)), inv_r3, bx);
+    by = _mm512_fmadd_pd(_mm512_fmsub_pd(dz, rx, _mm512_mul_pd(dx, rz)), inv_r3, by);
+    bz = _mm512_fmadd_pd(_mm512_fmsub_pd(dx, ry, _mm512_mul_pd(dy, rx)), inv_r3, bz);
+  }
+
+  cv::Vec3d field = biotSavartSumScalar<double, double>(s, p, n);
+  field += cv::Vec3d(_mm512_reduce_add_pd(bx), _mm512_reduce_add_pd(by), _mm512_reduce_add_pd(bz));
+  return field;
+}
+
+
+// Float segments, 8 lanes. With A = double every lane's term is widened before it is summed
+template <typename A> __attribute__((target("avx2,fma")))
+static cv::Vec3d biotSavartSumFloatAVX2(const WireSegmentsFloat& s, const cv::Vec3d& p){
+  const size_t lanes = 8;
+  size_t n = s.size() - s.size() % lanes;
+
+  __m256 px = _mm256_set1_ps(p[0]);
+  __m256 py = _mm256_set1_ps(p[1]);
+  __m256 pz = _mm256_set1_ps(p[2]);
+  __m256 one = _mm256_set1_ps(1.0f);
+  __m256 bx = _mm256_setzero_ps();
+  __m256 by = _mm256_setzero_ps();
+  __m256 bz = _mm256_setzero_ps();
+  __m256d bx_lo = _mm256_setzero_pd(), bx_hi = _mm256_setzero_pd();
+  __m256d by_lo = _mm256_setzero_pd(), by_hi = _mm256_setzero_pd();
+  __m256d bz_lo = _mm256_setzero_pd(), bz_hi = _mm256_setzero_pd();
+
+  for(size_t i = 0; i < n; i += lanes){
+    __m256 rx = _mm256_sub_ps(px, _mm256_load_ps(&s.pos_x[i]));
+    __m256 ry = _mm256_sub_ps(py, _mm256_load_ps(&s.pos_y[i]));
+    __m256 rz = _mm256_sub_ps(pz, _mm256_load_ps(&s.pos_z[i]));
+    __m256 dx = _mm256_load_ps(&s.dir_x[i]);
+    __m256 dy = _mm256_load_ps(&s.dir_y[i]);
+    __m256 dz = _mm256_load_ps(&s.dir_z[i]);
+
+    __m256 r2 = _mm256_fmadd_ps(rx, rx, _mm256_fmadd_ps(ry, ry, _mm256_mul_ps(rz, rz)));
+    __m256 inv_r3 = _mm256_div_ps(one, _mm256_mul_ps(r2, _mm256_sqrt_ps(r2)));
+
+    __m256 tx = _mm256_mul_ps(_mm256_fmsub_ps(dy, rz, _mm256_mul_ps(dz, ry)), inv_r3);
+    __m256 ty = _mm256_mul_ps(_mm256_fmsub_ps(dz, rx, _mm256_mul_ps(dx, rz)), inv_r3);
+    __m256 tz = _mm256_mul_ps(_mm256_fmsub_ps(dx, ry, _mm256_mul_ps(dy, rx)), inv_r3);
+
+    if(sizeof(A) == sizeof(double)){
+      bx_lo = _mm256_add_pd(bx_lo, _mm256_cvtps_pd(_mm256_castps256_ps128(tx)));
+      bx_hi = _mm256_add_pd(bx_hi, _mm256_cvtps_pd(_mm256_extractf128_ps(tx, 1)));
+      by_lo = _mm256_add_pd(by_lo, _mm256_cvtps_pd(_mm256_castps256_ps128(ty)));
+      by_hi = _mm256_add_pd(by_hi, _mm256_cvtps_pd(_mm256_extractf128_ps(ty, 1)));
+      bz_lo = _mm256_add_pd(bz_lo, _mm256_cvtps_pd(_mm256_castps256_ps128(tz)));
+      bz_hi = _mm256_add_pd(bz_hi, _mm256_cvtps_pd(_mm256_extractf128_ps(tz, 1)));
+    }else{
+      bx = _mm256_add_ps(bx, tx);
+      by = _mm256_add_ps(by, ty);
+      bz = _mm256_add_ps(bz, tz);
+    }
+  }
+
+  // Fold the float sums into the double ones, so both modes reduce the same way
+  bx_lo = _mm256_add_pd(_mm256_add_pd(bx_lo, bx_hi), _mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(bx)), _mm256_cvtps_pd(_mm256_extractf128_ps(bx, 1))));
+  by_lo = _mm256_add_pd(_mm256_add_pd(by_lo, by_hi), _mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(by)), _mm256_cvtps_pd(_mm256_extractf128_ps(by, 1))));
+  bz_lo = _mm256_add_pd(_mm256_add_pd(bz_lo, bz_hi), _mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(bz)), _mm256_cvtps_pd(_mm256_extractf128_ps(bz, 1))));
+
+  alignas(32) double sx[4], sy[4], sz[4];
+  _mm256_store_pd(sx, bx_lo);
+  _mm256_store_pd(sy, by_lo);
+  _mm256_store_pd(sz, bz_lo);
+
+  cv::Vec3d field = biotSavartSumScalar<float, A>(s, p, n);
+  for(size_t k = 0; k < 4; k++){
+    field += cv::Vec3d(sx[k], sy[k], sz[k]);
+  }
+  return field;
+}
+
+
+// Lower and upper 8 floats of a vector widened to double
+__attribute__((target("avx512f")))
+static inline __m512d low(__m512 v){
+  return _mm512_cvtps_pd(_mm512_castps512_ps256(v));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512d high(__m512 v){
+  return _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1)));
+}
+
+
+// Float segments, 16 lanes, widened per lane for A = double as above
+template <typename A> __attribute__((target("avx512f")))
+static cv::Vec3d biotSavartSumFloatAVX512(const WireSegmentsFloat& s, const cv::Vec3d& p){
+  const size_t lanes = 16;
+  size_t n = s.size() - s.size() % lanes;
+
+  __m512 px = _mm512_set1_ps(p[0]);
+  __m512 py = _mm512_set1_ps(p[1]);
+  __m512 pz = _mm512_set1_ps(p[2]);
+  __m512 one = _mm512_set1_ps(1.0f);
+  __m512 bx = _mm512_setzero_ps();
+  __m512 by = _mm512_setzero_ps();
+  __m512 bz = _mm512_setzero_ps();
+  __m512d bx_d = _mm512_setzero_pd();
+  __m512d by_d = _mm512_setzero_pd();
+  __m512d bz_d = _mm512_setzero_pd();
+
+  for(size_t i = 0; i < n; i += lanes){
+    __m512 rx = _mm512_sub_ps(px, _mm512_load_ps(&s.pos_x[i]));
+    __m512 ry = _mm512_sub_ps(py, _mm512_load_ps(&s.pos_y[i]));
+    __m512 rz = _mm512_sub_ps(pz, _mm512_load_ps(&s.pos_z[i]));
+    __m512 dx = _mm512_load_ps(&s.dir_x[i]);
+    __m512 dy = _mm512_load_ps(&s.dir_y[i]);
+    __m512 dz = _mm512_load_ps(&s.dir_z[i]);
+
+    __m512 r2 = _mm512_fmadd_ps(rx, rx, _mm512_fmadd_ps(ry, ry, _mm512_mul_ps(rz, rz)));
+    __m512 inv_r3 = _mm512_div_ps(one, _mm512_mul_ps(r2, _mm512_sqrt_ps(r2)));
+
+    __m512 tx = _mm512_mul_ps(_mm512_fmsub_ps(dy, rz, _mm512_mul_ps(dz, ry)), inv_r3);
+    __m512 ty = _mm512_mul_ps(_mm512_fmsub_ps(dz, rx, _mm512_mul_ps(dx, rz)), inv_r3);
+    __m512 tz = _mm512_mul_ps(_mm512_fmsub_ps(dx, ry, _mm512_mul_ps(dy, rx)), inv_r3);
+
+    if(sizeof(A) == sizeof(double)){
+      bx_d = _mm512_add_pd(bx_d, _mm512_add_pd(low(tx), high(tx)));
+      by_d = _mm512_add_pd(by_d, _mm512_add_pd(low(ty), high(ty)));
+      bz_d = _mm512_add_pd(bz_d, _mm512_add_pd(low(tz), high(tz)));
+    }else{
+      bx = _mm512_add_ps(bx, tx);
+      by = _mm512_add_ps(by, ty);
+      bz = _mm512_add_ps(bz, tz);
+    }
+  }
+
+  cv::Vec3d field = biotSavartSumScalar<float, A>(s, p, n);
+  field += cv::Vec3d(_mm512_reduce_add_pd(bx_d), _mm512_reduce_add_pd(by_d), _mm512_reduce_add_pd(bz_d));
+  field += cv::Vec3d(_mm512_reduce_add_ps(bx), _mm512_reduce_add_ps(by), _mm512_reduce_add_ps(bz));
+  return field;
+}
+
+
+template <typename T> using BiotSavartKernel = cv::Vec3d (*)(const WireSegmentsT<T>&, const cv::Vec3d&);
+
+template <typename T, typename A> static cv::Vec3d biotSavartSumFallback(const WireSegmentsT<T>& s, const cv::Vec3d& p){
+  return biotSavartSumScalar<T, A>(s, p, 0);
+}
+
+
+// Widest kernel the cpu supports for each storage and accumulation type
+template <typename T, typename A> struct BiotSavartKernels;
+
+template <> struct BiotSavartKernels<double, double> {
+  static constexpr BiotSavartKernel<double> avx512 = biotSavartSumAVX512;
+  static constexpr BiotSavartKernel<double> avx2 = biotSavartSumAVX2;
+};
+
+template <typename A> struct BiotSavartKernels<float, A> {
+  static constexpr BiotSavartKernel<float> avx512 = biotSavartSumFloatAVX512<A>;
+  static constexpr BiotSavartKernel<float> avx2 = biotSavartSumFloatAVX2<A>;
+};
+
+
+template <typename T, typename A> static BiotSavartKernel<T> selectBiotSavartKernel(){
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f")){
+    return BiotSavartKernels<T, A>::avx512;
+  }
+  if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")){
+    return BiotSavartKernels<T, A>::avx2;
+  }
+  return biotSavartSumFallback<T, A>;
+}
+
+
+template <typename T, typename A> cv::Vec3d biotSavartSum(const WireSegmentsT<T>& segments, const cv::Vec3d& pos){
+  static const BiotSavartKernel<T> kernel = selectBiotSavartKernel<T, A>();
+  return kernel(segments, pos);
+}
+
+
+template cv::Vec3d biotSavartSum<double, double>(const WireSegments&, const cv::Vec3d&);
+template cv::Vec3d biotSavartSum<float, float>(const WireSegmentsFloat&, const cv::Vec3d&);
+template cv::Vec3d biotSavartSum<float, double>(const WireSegmentsFloat&, const cv::Vec3d&);
+template cv::Vec3d biotSavartSumScalar<double, double>(const WireSegments&, const cv::Vec3d&, size_t);
+template cv::Vec3d biotSavartSumScalar<float, float>(const WireSegmentsFloat&, const cv::Vec3d&, size_t);
+template cv::Vec3d biotSavartSumScalar<float, double>(const WireSegmentsFloat&, const cv::Vec3d&, size_t);
+
+
+cv::Vec3d biotSavartSum(const WireSegments& segments, const WireSegmentsFloat& segments_float, const cv::Vec3d& pos, FieldPrecision precision){
+  if(precision == PRECISION_FLOAT){
+    return segments_float.getFieldVectorAtPos<float>(pos);
+  }
+  if(precision == PRECISION_MIXED){
+    return segments_float.getFieldVectorAtPos<double>(pos);
+  }
+  return segments.getFieldVectorAtPos<double>(pos);
+}
+
+
+// Segment count known at compile time, the compiler unrolls the whole loop
+template <int RES, int START = 0> static cv::Vec3d loopFieldSumUnrolled(const WireSegments& s, const cv::Vec3d& p){
+  double bx = 0, by = 0, bz = 0;
+
+#pragma GCC unroll 32
+  for(int i = START; i < RES; i++){
+    double rx = p[0] - s.pos_x[i];
+    double ry = p[1] - s.pos_y[i];
+    double rz = p[2] - s.pos_z[i];
+    double r2 = rx*rx + ry*ry + rz*rz;
+    double inv_r3 = 1.0 / (r2 * sqrt(r2));
+
+    bx += (s.dir_y[i]*rz - s.dir_z[i]*ry) * inv_r3;
+    by += (s.dir_z[i]*rx - s.dir_x[i]*rz) * inv_r3;
+    bz += (s.dir_x[i]*ry - s.dir_y[i]*rx) * inv_r3;
+  }
+
+  return cv::Vec3d(bx, by, bz);
+}
+
+
+// Same with 4 lanes, the RES % 4 remaining segments are summed by the scalar version
+template <int RES> __attribute__((target("avx2,fma")))
+static cv::Vec3d loopFieldSumUnrolledAVX2(const WireSegments& s, const cv::Vec3d& p){
+  const int lanes = 4;
+  const int n = RES - RES % lanes;
+
+  __m256d px = _mm256_set1_pd(p[0]);
+  __m256d py = _mm256_set1_pd(p[1]);
+  __m256d pz = _mm256_set1_pd(p[2]);
+  __m256d one = _mm256_set1_pd(1.0);
+  __m256d bx = _mm256_setzero_pd();
+  __m256d by = _mm256_setzero_pd();
+  __m256d bz = _mm256_setzero_pd();
+
+#pragma GCC unroll 8
+  for(int i = 0; i < n; i += lanes){
+    __m256d rx = _mm256_sub_pd(px, _mm256_load_pd(&s.pos_x[i]));
+    __m256d ry = _mm256_sub_pd(py, _mm256_load_pd(&s.pos_y[i]));
+    __m256d rz = _mm256_sub_pd(pz, _mm256_load_pd(&s.pos_z[i]));
+    __m256d dx = _mm256_load_pd(&s.dir_x[i]);
+    __m256d dy = _mm256_load_pd(&s.dir_y[i]);
+    __m256d dz = _mm256_load_pd(&s.dir_z[i]);
+
+    __m256d r2 = _mm256_fmadd_pd(rx, rx, _mm256_fmadd_pd(ry, ry, _mm256_mul_pd(rz, rz)));
+    __m256d inv_r3 = _mm256_div_pd(one, _mm256_mul_pd(r2, _mm256_sqrt_pd(r2)));
+
+    bx = _mm256_fmadd_pd(_mm256_fmsub_pd(dy, rz, _mm256_mul_pd(dz, ry)), inv_r3, bx);
+    by = _mm256_fmadd_pd(_mm256_fmsub_pd(dz, rx, _mm256_mul_pd(dx, rz)), inv_r3, by);
+    bz = _mm256_fmadd_pd(_mm256_fmsub_pd(dx, ry, _mm256_mul_pd(dy, rx)), inv_r3, bz);
+  }
+
+  alignas(32) double sx[lanes], sy[lanes], sz[lanes];
+  _mm256_store_pd(sx, bx);
+  _mm256_store_pd(sy, by);
+  _mm256_store_pd(sz, bz);
+
+  cv::Vec3d field = loopFieldSumUnrolled<RES, n>(s, p);
+  for(int k = 0; k < lanes; k++){
+    field += cv::Vec3d(sx[k], sy[k], sz[k]);
+  }
+  return field;
+}
+
+
+template <int RES> __attribute__((target("avx512f")))
+static cv::Vec3d loopFieldSumUnrolledAVX512(const WireSegments& s, const cv::Vec3d& p){
+  const int lanes = 8;
+  const int n = RES - RES % lanes;
+
+  __m512d px = _mm512_set1_pd(p[0]);
+  __m512d py = _mm512_set1_pd(p[1]);
+  __m512d pz = _mm512_set1_pd(p[2]);
+  __m512d one = _mm512_set1_pd(1.0);
+  __m512d bx = _mm512_setzero_pd();
+  __m512d by = _mm512_setzero_pd();
+  __m512d bz = _mm512_setzero_pd();
+
+#pragma GCC unroll 4
+  for(int i = 0; i < n; i += lanes){
+    __m512d rx = _mm512_sub_pd(px, _mm512_load_pd(&s.pos_x[i]));
+    __m512d ry = _mm512_sub_pd(py, _mm512_load_pd(&s.pos_y[i]));
+    __m512d rz = _mm512_sub_pd(pz, _mm512_load_pd(&s.pos_z[i]));
+    __m512d dx = _mm512_load_pd(&s.dir_x[i]);
+    __m512d dy = _mm512_load_pd(&s.dir_y[i]);
+    __m512d dz = _mm512_load_pd(&s.dir_z[i]);
+
+    __m512d r2 = _mm512_fmadd_pd(rx, rx, _mm512_fmadd_pd(ry, ry, _mm512_mul_pd(rz, rz)));
+    __m512d inv_r3 = _mm512_div_pd(one, _mm512_mul_pd(r2, _mm512_sqrt_pd(r2)));
+
+    bx = _mm512_fmadd_pd(_mm512_fmsub_pd(dy, rz, _mm512_mul_pd(dz, ry)), inv_r3, bx);
+    by = _mm512_fmadd_pd(_mm512_fmsub_pd(dz, rx, _mm512_mul_pd(dx, rz)), inv_r3, by);
+    bz = _mm512_fmadd_pd(_mm512_fmsub_pd(dx, ry, _mm512_mul_pd(dy, rx)), inv_r3, bz);
+  }
+
+  cv::Vec3d field = loopFieldSumUnrolled<RES, n>(s, p);
+  field += cv::Vec3d(_mm512_reduce_add_pd(bx), _mm512_reduce_add_pd(by), _mm512_reduce_add_pd(bz));
+  return field;
+}
+
+
+// Unrolled kernel of one resolution, picked once for the cpu. Loops narrower than 8 segments stay on 4 lanes
+template <int RES> static BiotSavartKernel<double> selectLoopFieldKernel(){
+  __builtin_cpu_init();
+  if(RES >= 8 && __builtin_cpu_supports("avx512f")){
+    return loopFieldSumUnrolledAVX512<RES>;
+  }
+  if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")){
+    return loopFieldSumUnrolledAVX2<RES>;
+  }
+  return loopFieldSumUnrolled<RES>;
+}
+
+
+template <int RES> static cv::Vec3d loopFieldSumFixed(const WireSegments& s, const cv::Vec3d& p){
+  static const BiotSavartKernel<double> kernel = selectLoopFieldKernel<RES>();
+  return kernel(s, p);
+}
+
+
+cv::Vec3d loopFieldSum(const WireSegments& segments, const cv::Vec3d& pos){
+  TRACE_COUNT(TRACE_INTERACTIONS, segments.size());
+  switch(segments.size()){
+    case 4:
+      return loopFieldSumFixed<4>(segments, pos);
+    case 8:
+      return loopFieldSumFixed<8>(segments, pos);
+    case 16:
+      return loopFieldSumFixed<16>(segments, pos);
+    case 30:
+      return loopFieldSumFixed<30>(segments, pos);
+    default:
+      return biotSavartSum(segments, pos);
+  }
+}
+
+
+// dA = ds / |r|, terms at zero distance are left out so a segment does not see itself
+static cv::Vec3d vectorPotentialSumScalar(const WireSegments& s, const cv::Vec3d& p, size_t start){
+  double ax = 0, ay = 0, az = 0;
+  size_t n = s.size();
+
+  for(size_t i = start; i < n; i++){
+    double rx = p[0] - s.pos_x[i];
+    double ry = p[1] - s.pos_y[i];
+    double rz = p[2] - s.pos_z[i];
+    double r2 = rx*rx + ry*ry + rz*rz;
+    if(r2 == 0){
+      continue;
+    }
+    double inv_r = 1 / std::sqrt(r2);
+
+    ax += s.dir_x[i] * inv_r;
+    ay += s.dir_y[i] * inv_r;
+    az += s.dir_z[i] * inv_r;
+  }
+
+  return cv::Vec3d(ax, ay, az);
+}
+
+
+__attribute__((target("avx2,fma")))
+static cv::Vec3d vectorPotentialSumAVX2(const WireSegments& s, const cv::Vec3d& p){
+  const size_t lanes = 4;
+  size_t n = s.size() - s.size() % lanes;
+
+  __m256d px = _mm256_set1_pd(p[0]);
+  __m256d py = _mm256_set1_pd(p[1]);
+  __m256d pz = _mm256_set1_pd(p[2]);
+  __m256d one = _mm256_set1_pd(1.0);
+  __m256d zero = _mm256_setzero_pd();
+  __m256d ax = _mm256_setzero_pd();
+  __m256d ay = _mm256_setzero_pd();
+  __m256d az = _mm256_setzero_pd();
+
+  for(size_t i = 0; i < n; i += lanes){
+    __m256d rx = _mm256_sub_pd(px, _mm256_load_pd(&s.pos_x[i]));
+    __m256d ry = _mm256_sub_pd(py, _mm256_load_pd(&s.pos_y[i]));
+    __m256d rz = _mm256_sub_pd(pz, _mm256_load_pd(&s.pos_z[i]));
+
+    __m256d r2 = _mm256_fmadd_pd(rx, rx, _mm256_fmadd_pd(ry, ry, _mm256_mul_pd(rz, rz)));
+    __m256d inv_r = _mm256_and_pd(_mm256_div_pd(one, _mm256_sqrt_pd(r2)), _mm256_cmp_pd(r2, zero, _CMP_NEQ_OQ));
+
+    ax = _mm256_fmadd_pd(_mm256_load_pd(&s.dir_x[i]), inv_r, ax);
+    ay = _mm256_fmadd_pd(_mm256_load_pd(&s.dir_y[i]), inv_r, ay);
+    az = _mm256_fmadd_pd(_mm256_load_pd(&s.dir_z[i]), inv_r, az);
+  }
+
+  alignas(32) double sx[lanes], sy[lanes], sz[lanes];
+  _mm256_store_pd(sx, ax);
+  _mm256_store_pd(sy, ay);
+  _mm256_store_pd(sz, az);
+
+  cv::Vec3d potential = vectorPotentialSumScalar(s, p, n);
+  for(size_t k = 0; k < lanes; k++){
+    potential += cv::Vec3d(sx[k], sy[k], sz[k]);
+  }
+  return potential;
+}
+
+
+__attribute__((target("avx512f")))
+static cv::Vec3d vectorPotentialSumAVX512(const WireSegments& s, const cv::Vec3d& p){
+  const size_t lanes = 8;
+  size_t n = s.size() - s.size() % lanes;
+
+  __m512d px = _mm512_set1_pd(p[0]);
+  __m512d py = _mm512_set1_pd(p[1]);
+  __m512d pz = _mm512_set1_pd(p[2]);
+  __m512d one = _mm512_set1_pd(1.0);
+  __m512d zero = _mm512_setzero_pd();
+  __m512d ax = _mm512_setzero_pd();
+  __m512d ay = _mm512_setzero_pd();
+  __m512d az = _mm512_setzero_pd();
+
+  for(size_t i = 0; i < n; i += lanes){
+    __m512d rx = _mm512_sub_pd(px, _mm512_load_pd(&s.pos_x[i]));
+    __m512d ry = _mm512_sub_pd(py, _mm512_load_pd(&s.pos_y[i]));
+    __m512d rz = _mm512_sub_pd(pz, _mm512_load_pd(&s.pos_z[i]));
+
+    __m512d r2 = _mm512_fmadd_pd(rx, rx, _mm512_fmadd_pd(ry, ry, _mm512_mul_pd(rz, rz)));
+    __mmask8 nonzero = _mm512_cmp_pd_mask(r2, zero, _CMP_NEQ_OQ);
+    __m512d inv_r = _mm512_maskz_div_pd(nonzero, one, _mm512_sqrt_pd(r2));
+
+    ax = _mm512_fmadd_pd(_mm512_load_pd(&s.dir_x[i]), inv_r, ax);
+    ay = _mm512_fmadd_pd(_mm512_load_pd(&s.dir_y[i]), inv_r, ay);
+    az = _mm512_fmadd_pd(_mm512_load_pd(&s.dir_z[i]), inv_r, az);
+  }
+
+  cv::Vec3d potential = vectorPotentialSumScalar(s, p, n);
+  potential += cv::Vec3d(_mm512_reduce_add_pd(ax), _mm512_reduce_add_pd(ay), _mm512_reduce_add_pd(az));
+  return potential;
+}
+
+
+static cv::Vec3d vectorPotentialSumFallback(const WireSegments& s, const cv::Vec3d& p){
+  return vectorPotentialSumScalar(s, p, 0);
+}
+
+
+static BiotSavartKernel<double> selectVectorPotentialKernel(){
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f")){
+    return vectorPotentialSumAVX512;
+  }
+  if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")){
+    return vectorPotentialSumAVX2;
+  }
+  return vectorPotentialSumFallback;
+}
+
+
+cv::Vec3d vectorPotentialSum(const WireSegments& segments, const cv::Vec3d& pos){
+  static const BiotSavartKernel<double> kernel = selectVectorPotentialKernel();
+  TRACE_COUNT(TRACE_INTERACTIONS, segments.size());
+  return kernel(segments, pos);
+}
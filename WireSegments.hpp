@@ -0,0 +1,133 @@
+#pragma once
+
+// stdlib
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iomanip>
+#include <vector>
+#include <new>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// user headers
+#include "util.hpp"
+#include "Trace.hpp"
+
+
+
+// Cache line alignment, also wide enough for AVX-512 loads
+#define SEGMENT_ALIGNMENT 64
+
+
+template <typename T> struct AlignedAllocator {
+  typedef T value_type;
+
+  AlignedAllocator() = default;
+  template <typename U> AlignedAllocator(const AlignedAllocator<U>&){}
+
+  T* allocate(size_t n){
+    return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(SEGMENT_ALIGNMENT)));
+  }
+  void deallocate(T* p, size_t){
+    ::operator delete(p, std::align_val_t(SEGMENT_ALIGNMENT));
+  }
+
+  template <typename U> bool operator==(const AlignedAllocator<U>&) const { return true; }
+  template <typename U> bool operator!=(const AlignedAllocator<U>&) const { return false; }
+};
+
+typedef std::vector<double, AlignedAllocator<double>> AlignedVector;
+
+
+// Storage and accumulation types of a field evaluation, chosen per call site
+enum FieldPrecision {
+  PRECISION_FLOAT, // float segments, float sums: twice the SIMD width, for field maps
+  PRECISION_MIXED, // float segments, double sums
+  PRECISION_DOUBLE // double segments, double sums: reference, used for torque
+};
+
+
+/*
+  Structure-of-arrays storage of straight wire segments in scalar type T.
+  Segment i starts at (pos_x[i], pos_y[i], pos_z[i]) and spans (dir_x[i], dir_y[i], dir_z[i]).
+  Directions may be pre-scaled by the current of the segment.
+ */
+template <typename T> class WireSegmentsT {
+public:
+  typedef std::vector<T, AlignedAllocator<T>> Values;
+  Values pos_x, pos_y, pos_z;
+  Values dir_x, dir_y, dir_z;
+
+  void push_back(const FieldVector& field_vector, double scale = 1){
+    pos_x.push_back(field_vector.pos[0]);
+    pos_y.push_back(field_vector.pos[1]);
+    pos_z.push_back(field_vector.pos[2]);
+    dir_x.push_back(field_vector.dir[0] * scale);
+    dir_y.push_back(field_vector.dir[1] * scale);
+    dir_z.push_back(field_vector.dir[2] * scale);
+  }
+
+  // Appends segments of any scalar type, converting to T
+  template <typename U> void append(const WireSegmentsT<U>& segments, double scale = 1){
+    reserve(size() + segments.size());
+    for(size_t i = 0; i < segments.size(); i++){
+      pos_x.push_back(segments.pos_x[i]);
+      pos_y.push_back(segments.pos_y[i]);
+      pos_z.push_back(segments.pos_z[i]);
+      dir_x.push_back(segments.dir_x[i] * scale);
+      dir_y.push_back(segments.dir_y[i] * scale);
+      dir_z.push_back(segments.dir_z[i] * scale);
+    }
+  }
+
+  void reserve(size_t n){
+    for(Values* values : {&pos_x, &pos_y, &pos_z, &dir_x, &dir_y, &dir_z}){
+      values->reserve(n);
+    }
+  }
+
+  void clear(){
+    for(Values* values : {&pos_x, &pos_y, &pos_z, &dir_x, &dir_y, &dir_z}){
+      values->clear();
+    }
+  }
+
+  size_t size() const { return pos_x.size(); }
+  size_t getBytes() const { return 6 * pos_x.capacity() * sizeof(T); } // Heap bytes held
+
+  // Field at position from all segments at unit current, summed in A
+  template <typename A = T> cv::Vec3d getFieldVectorAtPos(const cv::Vec3d& pos) const;
+};
+
+typedef WireSegmentsT<double> WireSegments;
+typedef WireSegmentsT<float> WireSegmentsFloat;
+
+
+// Sum of ds x r / |r|^3 over the segments in T, accumulated in A, dispatched to the widest SIMD path the cpu supports.
+// Instantiated for <double, double>, <float, float> and <float, double>
+template <typename T, typename A = T> cv::Vec3d biotSavartSum(const WireSegmentsT<T>&, const cv::Vec3d&);
+template <typename T, typename A = T> cv::Vec3d biotSavartSumScalar(const WireSegmentsT<T>&, const cv::Vec3d&, size_t start = 0);
+
+// Field of one closed loop at unit current, fully unrolled for the resolutions of LoopTable.hpp, otherwise biotSavartSum
+cv::Vec3d loopFieldSum(const WireSegments&, const cv::Vec3d&);
+
+// Evaluates the double store or its float copy, depending on precision
+cv::Vec3d biotSavartSum(const WireSegments&, const WireSegmentsFloat&, const cv::Vec3d&, FieldPrecision);
+
+// Vector potential sum of ds / |r| over the segments taken as current elements at pos, skipping any at zero distance.
+// Neumann integrals of mutual inductance are dot products of wire segments with it
+cv::Vec3d vectorPotentialSum(const WireSegments&, const cv::Vec3d&);
+
+
+template <typename T> template <typename A> cv::Vec3d WireSegmentsT<T>::getFieldVectorAtPos(const cv::Vec3d& pos) const {
+  TRACE_COUNT(TRACE_INTERACTIONS, size());
+  return biotSavartSum<T, A>(*this, pos);
+}
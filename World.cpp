@@ -5,6 +5,9 @@
 #include <cmath>
 #include <iomanip>
 #include <algorithm>
+#include <thread>
+#include <atomic>
+#include <chrono>
 
 // opencv
 #include <opencv2/core/core.hpp>
@@ -20,23 +23,58 @@
 #include "Dipole.hpp"
 #include "World.hpp"
 #include "Controller.hpp"
+#include "SimulationLog.hpp"
+#include "FieldVolume.hpp"
+#include "Trace.hpp"
 
 template <typename T> int sign(T val){
   return (T(0) < val) - (val < T(0));
 }
 
+// Side length in pixels of the square tiles handed out to worker threads
+#define FIELD_TILE_SIZE 32
+
 
 World::World(float _dt, Motor _motor, Controller _controller) :
   dt(_dt), motor(_motor), controller(_controller)
 {
   // Initialize magnetic field
-  magnetic_field = std::vector<std::vector<cv::Vec3d>>(dim, std::vector<cv::Vec3d>(dim, cv::Vec3d(0, 0, 0)));
-  force_field = std::vector<std::vector<cv::Vec3d>>(dim, std::vector<cv::Vec3d>(dim, cv::Vec3d(0, 0, 0)));
+  magnetic_field.resize(dim, dim);
+  force_field.resize(dim, dim);
 }
 
 
 void World::update(){
-  time += dt;
+  step_count++;
+  time = step_count * dt;
+  if(controller.isEnabled()){
+    controller.update(motor, dt);
+  }
+  motor.update(dt);
+  if(simulation_log){
+    simulation_log->record(double(step_count) * dt, motor.getState(), controller);
+  }
+}
+
+
+double World::run(double duration, const std::function<void(float time, const MotorState&)>& observer){
+  /*
+    Steps the world headless for the given simulated duration, calling the observer after every step.
+    Returns the real-time factor: simulated seconds per wall-clock second.
+   */
+  long steps = lround(duration / dt);
+  auto start = std::chrono::steady_clock::now();
+
+  for(long i = 0; i < steps; i++){
+    update();
+    if(observer){
+      observer(time, motor.getState());
+    }
+  }
+
+  double wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  real_time_factor = (wall_time > 0) ? steps * dt / wall_time : 0;
+  return real_time_factor;
 }
 
 
@@ -45,36 +83,440 @@ float World::getTime(){
 }
 
 
+double World::getRealTimeFactor(){
+  return real_time_factor;
+}
+
+
+void World::setLog(SimulationLog* _simulation_log){
+  simulation_log = _simulation_log;
+}
+
+
+void World::setThreadCount(int _thread_count){
+  thread_count = std::max(1, _thread_count);
+}
+
+
+int World::getThreadCount(){
+  return thread_count;
+}
+
+
+void World::setFieldPrecision(FieldPrecision _field_precision){
+  field_precision = _field_precision;
+}
+
+
+FieldPrecision World::getFieldPrecision(){
+  return field_precision;
+}
+
+
+void World::forEachTile(const std::function<void(int x0, int y0, int x1, int y1)>& tile_func){
+  /* 
+    Splits the dim x dim grid into square tiles which worker threads pull from a shared counter.
+    Each pixel is owned by exactly one tile, so writes never overlap.
+   */
+  int tiles_per_row = (dim + FIELD_TILE_SIZE - 1) / FIELD_TILE_SIZE;
+  int tile_num = tiles_per_row * tiles_per_row;
+  std::atomic<int> next_tile(0);
+
+  auto worker = [&](){
+    for(int tile = next_tile++; tile < tile_num; tile = next_tile++){
+      int x0 = (tile % tiles_per_row) * FIELD_TILE_SIZE;
+      int y0 = (tile / tiles_per_row) * FIELD_TILE_SIZE;
+      TRACE_SCOPE("World::forEachTile tile");
+      tile_func(x0, y0, std::min<int>(x0 + FIELD_TILE_SIZE, dim), std::min<int>(y0 + FIELD_TILE_SIZE, dim));
+    }
+  };
+
+  if(thread_count == 1){
+    worker();
+    return;
+  }
+
+  std::vector<std::thread> workers;
+  for(int i = 0; i < thread_count; i++){
+    workers.emplace_back(worker);
+  }
+  for(int i = 0; i < workers.size(); i++){
+    workers[i].join();
+  }
+}
+
+
+// Field of the given coils at one position, evaluated at the field map precision
+cv::Vec3d World::evaluateCoilField(const ConstView<Coil>& coils, const cv::Vec3d& pos) const {
+  cv::Vec3d field(0, 0, 0);
+  for(int n = 0; n < coils.size(); n++){
+    field += coils[n].getFieldVectorAtPos(pos, field_precision);
+  }
+  return field;
+}
+
+
+// Field of all coils, then all magnets, at one position
+cv::Vec3d World::evaluateField(const cv::Vec3d& pos) const {
+  return evaluateCoilField(motor.getCoils(), pos) + motor.getMagnetFieldVectorAtPos(pos);
+}
+
+
 void World::generateField(double z){
   // Generate vector field in xy-plane at given z-height
+  TRACE_SCOPE("World::generateField");
+
+  // Every pixel is overwritten, so the grid is only reallocated if its shape changed
+  magnetic_field.resize(dim, dim);
+  field_z = z;
 
-  // Reset magnetic field
-  magnetic_field = std::vector<std::vector<cv::Vec3d>>(dim, std::vector<cv::Vec3d>(dim, cv::Vec3d(0, 0, 0)));
+  // The magnet part is kept as its own grid, it is summed separately anyway
+  bool keep_magnets = !motor.getMagnets().empty();
+  if(keep_magnets){
+    magnet_field.resize(dim, dim);
+  }
+  field_magnets = keep_magnets ? FIELD_MAGNETS_GRID : FIELD_MAGNETS_NONE;
+  ConstView<Coil> coils = motor.getCoils();
 
   // Center view
   cv::Vec3d offset(-dim/2, -dim/2, 0);
-  
-  // Generate field for coils
-  for(int n = 0; n < motor.getCoils().size(); n++){
-    Coil temp_coil = motor.getCoils()[n];
-    for(int y = 0; y < magnetic_field.size(); y++){ // Row or Y
-      for(int x = 0; x < magnetic_field[y].size(); x++){ // Collumn or X
+
+  // Sources are summed per pixel in the same order for any thread count, so results are identical
+  forEachTile([&](int x0, int y0, int x1, int y1){
+    for(int y = y0; y < y1; y++){ // Row or Y
+      for(int x = x0; x < x1; x++){ // Collumn or X
         cv::Vec3d pos = cv::Vec3d(x, y, z) + offset;
-        magnetic_field[y][x] += temp_coil.getFieldVectorAtPos(pos);
+        cv::Vec3d magnets = motor.getMagnetFieldVectorAtPos(pos);
+        magnetic_field.set(y, x, evaluateCoilField(coils, pos) + magnets);
+        if(keep_magnets){
+          magnet_field.set(y, x, magnets);
+        }
+      }
+    }
+  });
+}
+
+
+// A cell is refined when its corner magnitudes differ by more than this factor
+#define ADAPTIVE_MAX_CELL_RATIO 4
+
+
+/*
+  Quadtree refinement inside one tile for World::generateFieldAdaptive.
+  Only pixels inside the tile are written; tile corners on the shared lattice were evaluated beforehand,
+  other points outside the tile are evaluated but not stored.
+ */
+struct AdaptiveRefiner {
+  WorldFieldGrid& grid;
+  std::vector<uint8_t>& evaluated;
+  const std::function<cv::Vec3d(int x, int y)>& evaluate;
+  double tolerance;
+  int own_x0, own_y0, own_x1, own_y1;
+  long evaluations = 0;
+
+  bool owns(int x, int y) const {
+    return x >= own_x0 && x < own_x1 && y >= own_y0 && y < own_y1;
+  }
+
+  static bool isLatticePoint(int x, int y){
+    return (x % FIELD_TILE_SIZE == 0 || x == dim - 1) && (y % FIELD_TILE_SIZE == 0 || y == dim - 1);
+  }
+
+  cv::Vec3d sample(int x, int y){
+    size_t i = size_t(y) * dim + x;
+    bool own = owns(x, y);
+    if((own || isLatticePoint(x, y)) && evaluated[i]){
+      return grid.get(y, x);
+    }
+    cv::Vec3d field = evaluate(x, y);
+    evaluations++;
+    if(own){
+      grid.set(y, x, field);
+      evaluated[i] = 1;
+    }
+    return field;
+  }
+
+  static cv::Vec3d bilinear(const cv::Vec3d& c00, const cv::Vec3d& c10, const cv::Vec3d& c01, const cv::Vec3d& c11, double u, double v){
+    return (1 - v) * ((1 - u) * c00 + u * c10) + v * ((1 - u) * c01 + u * c11);
+  }
+
+  void refine(int x0, int y0, int x1, int y1){
+    cv::Vec3d c00 = sample(x0, y0), c10 = sample(x1, y0), c01 = sample(x0, y1), c11 = sample(x1, y1);
+    if(x1 - x0 <= 1 && y1 - y0 <= 1){
+      return;
+    }
+
+    int xm = (x0 + x1) / 2, ym = (y0 + y1) / 2;
+    double width = std::max(x1 - x0, 1), height = std::max(y1 - y0, 1);
+
+    // Gradient: corner magnitudes must be finite and within a bounded ratio
+    double norms[4] = {cv::norm(c00), cv::norm(c10), cv::norm(c01), cv::norm(c11)};
+    double norm_min = *std::min_element(norms, norms + 4);
+    double norm_max = *std::max_element(norms, norms + 4);
+    bool smooth = std::isfinite(norm_max) && norm_max <= ADAPTIVE_MAX_CELL_RATIO * norm_min;
+
+    // Interpolation error at the center and edge midpoints
+    int test_points[5][2] = {{xm, ym}, {xm, y0}, {xm, y1}, {x0, ym}, {x1, ym}};
+    for(int k = 0; k < 5 && smooth; k++){
+      int x = test_points[k][0], y = test_points[k][1];
+      cv::Vec3d exact = sample(x, y);
+      cv::Vec3d approx = bilinear(c00, c10, c01, c11, (x - x0) / width, (y - y0) / height);
+      double exact_norm = cv::norm(exact);
+      smooth = std::isfinite(exact_norm) && cv::norm(exact - approx) <= tolerance * exact_norm;
+    }
+
+    if(!smooth){
+      int xs[3] = {x0, xm, x1}, ys[3] = {y0, ym, y1};
+      int x_parts = (x1 - x0 > 1) ? 2 : 1, y_parts = (y1 - y0 > 1) ? 2 : 1;
+      if(x_parts == 1) xs[1] = x1;
+      if(y_parts == 1) ys[1] = y1;
+      for(int j = 0; j < y_parts; j++){
+        for(int i = 0; i < x_parts; i++){
+          refine(xs[i], ys[j], xs[i + 1], ys[j + 1]);
+        }
+      }
+      return;
+    }
+
+    // Fill the rest of the cell from its corners
+    for(int y = std::max(y0, own_y0); y <= std::min(y1, own_y1 - 1); y++){
+      for(int x = std::max(x0, own_x0); x <= std::min(x1, own_x1 - 1); x++){
+        if(!evaluated[size_t(y) * dim + x]){
+          grid.set(y, x, bilinear(c00, c10, c01, c11, (x - x0) / width, (y - y0) / height));
+        }
+      }
+    }
+  }
+};
+
+
+long World::generateFieldAdaptive(double z, double tolerance){
+  /* 
+    Adaptive alternative to generateField for the same grid.
+    1) The field is evaluated exactly on the lattice of tile corners.
+    2) Each tile is a quadtree root. A cell is split while bilinear interpolation of its corners misses the exact field
+       at its center or edge midpoints by more than tolerance (relative), or its corner magnitudes differ too much.
+       Accepted cells are filled by interpolation, cells down to one pixel are exact.
+    Refinement only depends on the field, so the result does not depend on the thread count.
+    Returns the number of exact field evaluations.
+   */
+  TRACE_SCOPE("World::generateFieldAdaptive");
+  magnetic_field.resize(dim, dim);
+  field_z = z;
+  field_magnets = FIELD_MAGNETS_NONE;
+  std::vector<uint8_t> evaluated(size_t(dim) * dim, 0);
+  cv::Vec3d offset(-dim/2, -dim/2, 0);
+  std::atomic<long> evaluations(0);
+
+  std::function<cv::Vec3d(int x, int y)> evaluate = [&](int x, int y){
+    return evaluateField(cv::Vec3d(x, y, z) + offset);
+  };
+
+  // Lattice points, each owned by the tile it lies in
+  forEachTile([&](int x0, int y0, int x1, int y1){
+    long count = 0;
+    for(int y = y0; y < y1; y++){
+      for(int x = x0; x < x1; x++){
+        if(AdaptiveRefiner::isLatticePoint(x, y)){
+          magnetic_field.set(y, x, evaluate(x, y));
+          evaluated[size_t(y) * dim + x] = 1;
+          count++;
+        }
+      }
+    }
+    evaluations += count;
+  });
+
+  forEachTile([&](int x0, int y0, int x1, int y1){
+    AdaptiveRefiner refiner{magnetic_field, evaluated, evaluate, tolerance, x0, y0, x1, y1};
+    refiner.refine(x0, y0, std::min<int>(x1, dim - 1), std::min<int>(y1, dim - 1));
+    evaluations += refiner.evaluations;
+  });
+
+  return evaluations;
+}
+
+
+bool World::generateFieldVolume(FieldVolume& volume){
+  /* 
+    Fills a volume created with FieldVolume::create, one z-slab per work item.
+    Workers pull slabs from a shared counter, evaluate them into their own buffer and stream them to the file,
+    so at most thread_count slabs are held in memory.
+   */
+  TRACE_SCOPE("World::generateFieldVolume");
+  int nx = volume.getSizeX();
+  int ny = volume.getSizeY();
+  int nz = volume.getSizeZ();
+  std::atomic<int> next_slab(0);
+  std::atomic<bool> failed(false);
+
+  // Same sum as evaluateField, with the coils view fetched once for the whole box
+  ConstView<Coil> coils = motor.getCoils();
+
+  auto worker = [&](){
+    std::vector<float> slab(size_t(nx) * ny * 3);
+    for(int z = next_slab++; z < nz; z = next_slab++){
+      TRACE_SCOPE("World::generateFieldVolume slab");
+      for(int y = 0; y < ny; y++){
+        for(int x = 0; x < nx; x++){
+          cv::Vec3d pos = volume.getPosition(x, y, z);
+          cv::Vec3d field = evaluateCoilField(coils, pos) + motor.getMagnetFieldVectorAtPos(pos);
+
+          float* v = &slab[(size_t(y) * nx + x) * 3];
+          v[0] = field[0];
+          v[1] = field[1];
+          v[2] = field[2];
+        }
       }
+      if(!volume.writeSlab(z, slab.data())){
+        failed = true;
+      }
+    }
+  };
+
+  if(thread_count == 1){
+    worker();
+  }else{
+    std::vector<std::thread> workers;
+    for(int i = 0; i < thread_count; i++){
+      workers.emplace_back(worker);
     }
+    for(int i = 0; i < workers.size(); i++){
+      workers[i].join();
+    }
+  }
+  return !failed;
+}
+
+
+void World::generateFieldBasis(double z){
+  /* 
+    The stator field is linear in the phase currents, so it is stored as one grid per phase at unit current.
+    Any current vector can then be rendered by composeField without integrating the coils again.
+   */
+  if(field_magnets == FIELD_MAGNETS_BASIS){
+    field_magnets = FIELD_MAGNETS_NONE;
+  }
+  cv::Vec3d offset(-dim/2, -dim/2, 0);
+
+  for(int phase = 0; phase < 3; phase++){
+    phase_field_basis[phase].resize(dim, dim);
+    ConstView<Coil> coils = motor.getPhaseCoils(phase);
+
+    forEachTile([&](int x0, int y0, int x1, int y1){
+      for(int y = y0; y < y1; y++){ // Row or Y
+        for(int x = x0; x < x1; x++){ // Collumn or X
+          cv::Vec3d pos = cv::Vec3d(x, y, z) + offset;
+          cv::Vec3d field(0, 0, 0);
+          for(int n = 0; n < coils.size(); n++){
+            field += biotSavartSum(coils[n].coil_segments, coils[n].coil_segments_float, pos, field_precision);
+          }
+          phase_field_basis[phase].set(y, x, field);
+        }
+      }
+    });
+  }
+
+  generateMagnetFieldBasis(z);
+  field_basis_z = z;
+  field_basis_ready = true;
+}
+
+
+void World::generateMagnetFieldBasis(double z){
+  // Only the magnets move with the rotor, so this is all that needs regenerating after setRotorAngle
+  if(field_magnets == FIELD_MAGNETS_BASIS){
+    field_magnets = FIELD_MAGNETS_NONE;
   }
+  magnet_field_basis.resize(dim, dim);
+  cv::Vec3d offset(-dim/2, -dim/2, 0);
 
-  // Generate field for magnets
-  for(int n = 0; n < motor.getMagnets().size(); n++){
-    Magnet temp_magnet = motor.getMagnets()[n];
-    for(int y = 0; y < magnetic_field.size(); y++){ // Row or Y
-      for(int x = 0; x < magnetic_field[y].size(); x++){ // Collumn or X
+  forEachTile([&](int x0, int y0, int x1, int y1){
+    for(int y = y0; y < y1; y++){ // Row or Y
+      for(int x = x0; x < x1; x++){ // Collumn or X
         cv::Vec3d pos = cv::Vec3d(x, y, z) + offset;
-        magnetic_field[y][x] += temp_magnet.getFieldVectorAtPos(pos);
+        magnet_field_basis.set(y, x, motor.getMagnetFieldVectorAtPos(pos));
       }
     }
+  });
+}
+
+
+void World::fitRotorFieldModel(double z, int harmonics){
+  // One ring per pixel out to the corners of the view
+  float r_max = dim / sqrt(2.0);
+  rotor_field_model = RotorFieldModel(harmonics, int(r_max) + 1, 0, r_max, 1, z, z);
+  rotor_field_model.fit(motor.getMagnets(), motor.getAngle());
+  rotor_model_z = z;
+}
+
+
+void World::setRotorAngle(float angle){
+  /* 
+    The motor always follows the angle. With a fitted rotor model the magnet grid is re-evaluated from the harmonics
+    at the height the model was fitted at, otherwise the magnet grid is integrated again.
+    Without a field basis at that height yet, the whole basis is generated there first.
+    Call composeField afterwards to update the magnetic field.
+   */
+  motor.setRotorAngle(angle);
+  if(field_magnets == FIELD_MAGNETS_BASIS){
+    field_magnets = FIELD_MAGNETS_NONE;
+  }
+
+  if(rotor_field_model.isFitted()){
+    rotor_field_model.setRotorAngle(angle);
+    if(!field_basis_ready || field_basis_z != rotor_model_z){
+      generateFieldBasis(rotor_model_z);
+      return;
+    }
+    cv::Vec3d offset(-dim/2, -dim/2, 0);
+    forEachTile([&](int x0, int y0, int x1, int y1){
+      for(int y = y0; y < y1; y++){
+        for(int x = x0; x < x1; x++){
+          magnet_field_basis.set(y, x, rotor_field_model.getFieldVectorAtPos(cv::Vec3d(x, y, rotor_model_z) + offset));
+        }
+      }
+    });
+    return;
+  }
+
+  if(!field_basis_ready){
+    generateFieldBasis(field_basis_z);
+    return;
+  }
+  generateMagnetFieldBasis(field_basis_z);
+}
+
+
+void World::composeField(){
+  composeField(motor.getCurrents());
+}
+
+
+void World::composeField(cv::Vec3d uvw){
+  // Magnetic field = magnets + U*B_u + V*B_v + W*B_w
+  if(!field_basis_ready){
+    generateFieldBasis(0);
   }
+  field_z = field_basis_z;
+  field_magnets = FIELD_MAGNETS_BASIS;
+
+  forEachTile([&](int x0, int y0, int x1, int y1){
+    for(int y = y0; y < y1; y++){
+      for(int x = x0; x < x1; x++){
+        magnetic_field.set(y, x, magnet_field_basis.get(y, x)
+          + uvw[0] * phase_field_basis[0].get(y, x)
+          + uvw[1] * phase_field_basis[1].get(y, x)
+          + uvw[2] * phase_field_basis[2].get(y, x));
+      }
+    }
+  });
+}
+
+
+cv::Mat World::renderMotor(){
+  return motor.renderMotor();
 }
 
 
@@ -85,7 +527,7 @@ cv::Mat World::renderVectorField(){
 
   for(int y = 0; y < canvas.size().height; y++){
     for(int x = 0; x < canvas.size().width; x++){
-      cv::Vec3d color = getColor(magnetic_field[y][x]);
+      cv::Vec3d color = getColor(magnetic_field.get(y, x));
       canvas.at<cv::Vec3b>(cv::Point(x, y)) = color;
     }
   }
@@ -95,7 +537,7 @@ cv::Mat World::renderVectorField(){
   for(int y = 0; y < canvas.size().height; y++){
     for(int x = 0; x < canvas.size().width; x++){
       if(((y % 11) == 0) && ((x % 11) == 0)){
-        cv::Vec3d field = magnetic_field[y][x];
+        cv::Vec3d field = magnetic_field.get(y, x);
         cv::Point2d pos = cv::Point2d(x, y);
         cv::Point2d dir = cv::Point2d(field[0], field[1]);
         dir /= cv::norm(dir);
@@ -115,7 +557,7 @@ cv::Mat World::renderMagnitudeField(){
   cv::cvtColor(canvas, canvas, cv::COLOR_BGR2HSV);
   for(int y = 0; y < canvas.size().height; y++){
     for(int x = 0; x < canvas.size().width; x++){
-      cv::Vec3d color = getColor(cv::norm(magnetic_field[y][x]));
+      cv::Vec3d color = getColor(cv::norm(magnetic_field.get(y, x)));
       canvas.at<cv::Vec3b>(cv::Point(x, y)) = color;
     }
   }
@@ -170,19 +612,80 @@ cv::Mat World::renderMagnitudeField(){
 
 
 void World::generateForceField(){
-  // Reset force field
-  force_field = std::vector<std::vector<cv::Vec3d>>(dim, std::vector<cv::Vec3d>(dim, cv::Vec3d(0, 0, 0)));
+  TRACE_SCOPE("World::generateForceField");
+  // Every pixel is overwritten, so the grid is only reallocated if its shape changed
+  force_field.resize(dim, dim);
 
   for(int y = 0; y < canvas_size.height; y++){
     for(int x = 0; x < canvas_size.width; x++){
-      float angle = atan2(magnetic_field[y][x][1], magnetic_field[y][x][0]);
+      cv::Vec3d field = magnetic_field.get(y, x);
+      float angle = atan2(field[1], field[0]);
 
       // Dipole test_dipole = Dipole(cv::Point2f(-dim/2 + x, -dim/2 + y), angle, 10000, .1, 4);
       Dipole test_dipole = Dipole(cv::Point2f(-dim/2 + x, -dim/2 + y), angle, 100, 1, 4);
 
-      force_field[y][x] = motor.getForceOnDipoleAtPos(test_dipole);
+      force_field.set(y, x, motor.getForceOnDipoleAtPos(test_dipole));
+    }
+  }
+}
+
+
+bool World::generateForceFieldFromGradient(){
+  /* 
+    Force on the same test dipole as generateForceField, taken from the magnetic field grid with central differences.
+    Same sign convention as generateForceField: the magnets push with grad(m . B_magnets), the coils with -grad(m . B_coils)
+    as Coil::forceOnWireDL is I B x dL. With B_coils = B - B_magnets that is F = grad(m . (2 B_magnets - B)).
+    The field is curl free between sources, so dB/dz is replaced by grad(B_z) and F_z = m . grad(B_z).
+    Requires generateField or composeField first, which keep the magnets' grid. Edges use one sided differences.
+   */
+  TRACE_SCOPE("World::generateForceFieldFromGradient");
+  bool has_magnets = !motor.getMagnets().empty();
+  const WorldFieldGrid* magnets = nullptr;
+  if(has_magnets){
+    if(field_magnets == FIELD_MAGNETS_GRID){
+      magnets = &magnet_field;
+    }else if(field_magnets == FIELD_MAGNETS_BASIS){
+      magnets = &magnet_field_basis;
+    }else{
+      std::cout << "No magnet field grid, call generateField or composeField first" << std::endl;
+      return false;
     }
   }
+
+  force_field.resize(dim, dim);
+  force_potential.resize(dim, dim);
+  Dipole test_dipole = Dipole(cv::Point2f(0, 0), 0, 100, 1, 4);
+  double test_moment = cv::norm(test_dipole.getSegmentMoment());
+
+  forEachTile([&](int x0, int y0, int x1, int y1){
+    for(int y = y0; y < y1; y++){
+      for(int x = x0; x < x1; x++){
+        cv::Vec3d field = -magnetic_field.get(y, x);
+        if(magnets){
+          field += 2 * magnets->get(y, x);
+        }
+        force_potential.set(y, x, field);
+      }
+    }
+  });
+
+  forEachTile([&](int x0, int y0, int x1, int y1){
+    for(int y = y0; y < y1; y++){
+      for(int x = x0; x < x1; x++){
+        cv::Vec3d field = magnetic_field.get(y, x);
+        float angle = atan2(field[1], field[0]);
+        cv::Vec3d m(test_moment * cos(angle), test_moment * sin(angle), 0);
+
+        int x_lo = std::max(x - 1, 0), x_hi = std::min<int>(x + 1, dim - 1);
+        int y_lo = std::max(y - 1, 0), y_hi = std::min<int>(y + 1, dim - 1);
+        cv::Vec3d dB_dx = (force_potential.get(y, x_hi) - force_potential.get(y, x_lo)) / double(x_hi - x_lo);
+        cv::Vec3d dB_dy = (force_potential.get(y_hi, x) - force_potential.get(y_lo, x)) / double(y_hi - y_lo);
+
+        force_field.set(y, x, cv::Vec3d(m.dot(dB_dx), m.dot(dB_dy), m[0] * dB_dx[2] + m[1] * dB_dy[2]));
+      }
+    }
+  });
+  return true;
 }
 
 
@@ -192,8 +695,8 @@ cv::Mat World::renderNorthSouth(){
 
   for(int x = 0; x < canvas.size().width; x++){
     for(int y = 0; y < canvas.size().height; y++){
-      cv::Vec3d force_vec = force_field[y][x];
-      cv::Vec3d magnetic_field_vec = magnetic_field[y][x];
+      cv::Vec3d force_vec = force_field.get(y, x);
+      cv::Vec3d magnetic_field_vec = magnetic_field.get(y, x);
 
       float value = force_vec.dot(magnetic_field_vec);
       float mag = sign(value)*log10(abs(value)+1);
@@ -239,12 +742,22 @@ cv::Vec3b World::getColor(cv::Vec3d vec){
 }
 
 
-std::vector<std::vector<cv::Vec3d>> World::getMagneticField(){
+Motor& World::getMotor(){
+  return motor;
+}
+
+
+Controller& World::getController(){
+  return controller;
+}
+
+
+const WorldFieldGrid& World::getMagneticField() const {
   return magnetic_field;
 }
 
 
-std::vector<std::vector<cv::Vec3d>> World::getForceField(){
+const WorldFieldGrid& World::getForceField() const {
   return force_field;
 }
 
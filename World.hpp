@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <cmath>
 #include <iomanip>
+#include <functional>
 
 // opencv
 #include <opencv2/core/core.hpp>
@@ -21,29 +22,82 @@
 #include "Motor.hpp"
 #include "Coil.hpp"
 #include "Dipole.hpp"
+#include "FieldGrid.hpp"
 
 
 
+class SimulationLog;
+class FieldVolume;
+
+
+// Where the magnet part of the magnetic field grid is kept, generateForceFieldFromGradient needs it apart from the coils
+enum FieldMagnets {
+  FIELD_MAGNETS_NONE, // Not kept, e.g. after generateFieldAdaptive
+  FIELD_MAGNETS_GRID, // In magnet_field, kept by generateField
+  FIELD_MAGNETS_BASIS // In magnet_field_basis, which composeField summed
+};
+
+
+typedef FieldGrid<FIELD_GRID_SCALAR> WorldFieldGrid;
+
+
 class World {
   float time = 0;
+  long step_count = 0; // Time is derived from the step count so it does not drift over long runs
   float dt;
+  double real_time_factor = 0;
+  SimulationLog* simulation_log = nullptr; // Not owned, every step is recorded while set
   Motor motor;
   Controller controller;
-  std::vector<std::vector<cv::Vec3d>> magnetic_field;
-  std::vector<std::vector<cv::Vec3d>> force_field;
+  WorldFieldGrid magnetic_field;
+  double field_z = 0; // Height the magnetic field grid was generated at
+  WorldFieldGrid magnet_field; // Magnets alone, alongside magnetic_field
+  FieldMagnets field_magnets = FIELD_MAGNETS_NONE;
+  WorldFieldGrid force_field;
+  WorldFieldGrid force_potential; // 2 B_magnets - B, for generateForceFieldFromGradient
+  // Field of each phase at unit current, and of the magnets alone
+  WorldFieldGrid phase_field_basis[3];
+  WorldFieldGrid magnet_field_basis;
+  bool field_basis_ready = false;
+  double field_basis_z = 0;
+  RotorFieldModel rotor_field_model;
+  double rotor_model_z = 0; // Height the rotor model was fitted at
+  int thread_count = 1;
+  FieldPrecision field_precision = PRECISION_FLOAT; // Of the coil field maps, the grids are float anyway. Magnets are always summed in double
+  cv::Vec3d evaluateCoilField(const ConstView<Coil>& coils, const cv::Vec3d& pos) const;
+  cv::Vec3d evaluateField(const cv::Vec3d& pos) const;
+  void forEachTile(const std::function<void(int x0, int y0, int x1, int y1)>&);
   cv::Vec3b getColor(float);
   cv::Vec3b getColor(cv::Vec3d);
 public:
   World(float dt, Motor, Controller);
   void update();
+  double run(double duration, const std::function<void(float time, const MotorState&)>& observer = nullptr);
   float getTime();
+  double getRealTimeFactor();
+  void setLog(SimulationLog*);
+  void setThreadCount(int);
+  int getThreadCount();
+  void setFieldPrecision(FieldPrecision);
+  FieldPrecision getFieldPrecision();
   void generateField(double);
+  long generateFieldAdaptive(double z, double tolerance = 0.01);
+  bool generateFieldVolume(FieldVolume&);
+  void generateFieldBasis(double);
+  void generateMagnetFieldBasis(double);
+  void fitRotorFieldModel(double z, int harmonics);
+  void setRotorAngle(float);
+  void composeField();
+  void composeField(cv::Vec3d);
+  Motor& getMotor();
+  Controller& getController();
   cv::Mat renderMotor();
   cv::Mat renderMagnitudeField();
   cv::Mat renderVectorField();
   cv::Mat renderNorthSouth();
   void generateForceField();
-  std::vector<std::vector<cv::Vec3d>> getMagneticField();
-  std::vector<std::vector<cv::Vec3d>> getForceField();
+  bool generateForceFieldFromGradient(); // False if the magnet part of the field grid was not kept
+  const WorldFieldGrid& getMagneticField() const;
+  const WorldFieldGrid& getForceField() const;
 };
 
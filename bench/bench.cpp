@@ -0,0 +1,339 @@
+// stdlib
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <functional>
+#include <fstream>
+#include <sstream>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// User headers
+#include "Motor.hpp"
+#include "Coil.hpp"
+#include "Dipole.hpp"
+#include "Magnet.hpp"
+#include "World.hpp"
+#include "Controller.hpp"
+
+
+/*
+  Micro-benchmarks of the physics kernels on fixed reference geometries.
+  Each case reports nanoseconds per source-target interaction, e.g. per wire segment and field point,
+  as CSV on stdout: name,size,ns_per_interaction,interactions,seconds
+
+  Usage: bench.out [--baseline bench/baseline.csv] [--update] [--threshold 1.25] [--filter name]
+  With a baseline every case slower than threshold times its baseline is reported and the exit code is 1.
+  --update rewrites the baseline with this run instead.
+ */
+
+// Each case is timed up to BENCH_REPEATS times, every time repeating its body for at least BENCH_MIN_SECONDS, and the best is kept.
+// Repeats stop early once a case has used BENCH_MAX_SECONDS, so whole-grid cases are timed from a single call
+#define BENCH_REPEATS 5
+#define BENCH_MIN_SECONDS 0.1
+#define BENCH_MAX_SECONDS 2.0
+
+
+struct BenchResult {
+  std::string name;
+  std::string size;
+  double ns_per_interaction;
+  double interactions;
+  double seconds;
+};
+
+
+// Keeps results alive so the compiler cannot drop the work
+static volatile double sink;
+
+
+static double bestSeconds(const std::function<void()>& body){
+  // Returns the best time of one call of body
+  auto warmup = std::chrono::steady_clock::now();
+  body();
+  double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - warmup).count();
+  double best = 1e300;
+  for(int repeat = 0; repeat < BENCH_REPEATS && (repeat == 0 || total < BENCH_MAX_SECONDS); repeat++){
+    int calls = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    do{
+      body();
+      calls++;
+      elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }while(elapsed < BENCH_MIN_SECONDS);
+    best = std::min(best, elapsed / calls);
+    total += elapsed;
+  }
+  return best;
+}
+
+
+static size_t coilSegments(ConstView<Coil> coils){
+  size_t n = 0;
+  for(int i = 0; i < coils.size(); i++){
+    n += coils[i].coil_wire_vectors.size();
+  }
+  return n;
+}
+
+
+static size_t magnetSegments(const std::vector<Magnet>& magnets){
+  size_t n = 0;
+  for(int i = 0; i < magnets.size(); i++){
+    n += magnets[i].getSegmentCount();
+  }
+  return n;
+}
+
+
+// Fixed field points around the motor, off the wires
+static std::vector<cv::Vec3d> queryPoints(){
+  std::vector<cv::Vec3d> points;
+  for(int i = 0; i < 64; i++){
+    double angle = 2 * M_PI * i / 64;
+    points.push_back(cv::Vec3d(113 * cos(angle), 113 * sin(angle), (i % 5) - 2.5));
+  }
+  return points;
+}
+
+
+// Reference motors: coil resolution and magnet size grow with the size class
+static Motor referenceMotor(int size){
+  int coil_res[3] = {8, 30, 30};
+  int magnet_pairs[3] = {1, 1, 2};
+  float magnet_depth[3] = {4, 4, 8};
+
+  Motor motor(3, 0, 10, 0.00001);
+  motor.generateCoils(300, -150, 70, 4, coil_res[size]);
+  motor.generateMagnets(magnet_pairs[size], 1000, magnet_depth[size], 4, 40, 8);
+  motor.setCurrentVector(0.3, 300);
+  return motor;
+}
+
+
+// Coil only motors for the whole-grid cases, every source is evaluated at dim x dim points
+static Motor referenceFieldMotor(int size){
+  int poles[3] = {1, 3, 3};
+  int coil_res[3] = {8, 8, 30};
+
+  Motor motor(poles[size], 0, 10, 0.00001);
+  motor.generateCoils(300, -150, 70, 4, coil_res[size]);
+  motor.setCurrentVector(0.3, 300);
+  return motor;
+}
+
+
+static std::vector<BenchResult> runBenchmarks(const std::string& filter){
+  const char* size_names[3] = {"small", "medium", "large"};
+  std::vector<BenchResult> results;
+  std::vector<cv::Vec3d> points = queryPoints();
+
+  auto report = [&](const std::string& name, int size, double interactions, double seconds){
+    BenchResult result = {name, size_names[size], seconds * 1e9 / interactions, interactions, seconds};
+    results.push_back(result);
+    std::cout << result.name << "," << result.size << "," << result.ns_per_interaction << "," << result.interactions << "," << result.seconds << std::endl;
+  };
+  auto selected = [&](const std::string& name){
+    return filter.empty() || name.find(filter) != std::string::npos;
+  };
+
+  for(int size = 0; size < 3; size++){
+    if(selected("coil_field")){
+      int res[3] = {8, 30, 100};
+      Coil coil(300, 70, 4, 0, cv::Point2d(0, 0), -150, res[size], 0.00001);
+      coil.setCurrent(1);
+      double seconds = bestSeconds([&](){
+        cv::Vec3d field;
+        for(int i = 0; i < points.size(); i++){
+          field += coil.getFieldVectorAtPos(points[i]);
+        }
+        sink = field[0];
+      });
+      report("coil_field", size, double(points.size()) * coil.coil_wire_vectors.size(), seconds);
+    }
+
+    if(selected("dipole_field")){
+      int res[3] = {4, 16, 64};
+      Dipole dipole(40, 4, 0, 1000, 1, res[size]);
+      double seconds = bestSeconds([&](){
+        cv::Vec3d field;
+        for(int i = 0; i < points.size(); i++){
+          field += dipole.getFieldVectorAtPos(points[i]);
+        }
+        sink = field[0];
+      });
+      report("dipole_field", size, double(points.size()) * dipole.dipole_wire_vectors.size(), seconds);
+    }
+
+    if(selected("generate_dipoles_polar")){
+      float depth[3] = {4, 12, 30};
+      float height[3] = {4, 8, 20};
+      Magnet magnet(40, M_PI / 2, 0, depth[size], height[size], 1000, 8, false);
+      double seconds = bestSeconds([&](){
+        magnet.generateDipolesPolar(0);
+      });
+      report("generate_dipoles_polar", size, magnetSegments(std::vector<Magnet>(1, magnet)), seconds);
+    }
+
+    if(selected("calculate_torque")){
+      Motor motor = referenceMotor(size);
+      double seconds = bestSeconds([&](){
+        sink = motor.calculateTorque();
+      });
+      report("calculate_torque", size, double(coilSegments(motor.getCoils())) * magnetSegments(motor.getMagnets()), seconds);
+    }
+
+    if(selected("torque_ripple") && size < 2){
+      Motor motor = referenceMotor(size);
+      double seconds = bestSeconds([&](){
+        sink = motor.generateTorqueRippleVector()[0];
+      });
+      report("torque_ripple", size, 360.0 * coilSegments(motor.getCoils()) * magnetSegments(motor.getMagnets()), seconds);
+    }
+
+    if(selected("generate_phase_model") && size < 2){
+      Motor motor = referenceMotor(size);
+      PhaseModel& phase_model = motor.getPhaseModel();
+      double seconds = bestSeconds([&](){
+        phase_model.generate(motor);
+      });
+      // Inductance: every coil segment pair
+      double coil_segments = coilSegments(motor.getCoils());
+      report("generate_phase_model", size, coil_segments * coil_segments, seconds);
+    }
+
+    if(selected("phase_step")){
+      Motor motor = referenceMotor(size);
+      PhaseModel& phase_model = motor.getPhaseModel();
+      phase_model.generate(motor);
+      TorqueMap& torque_map = motor.getTorqueMap();
+      torque_map.generate(motor);
+      const int steps = 10000;
+      double seconds = bestSeconds([&](){
+        cv::Vec3d currents(0, 0, 0);
+        cv::Vec3d voltages = clarkInv(cv::Vec2d(10, 0));
+        for(int i = 0; i < steps; i++){
+          currents = phase_model.step(currents, voltages, torque_map, i * 0.001, 1, 0.0001);
+        }
+        sink = currents[0];
+      });
+      report("phase_step", size, steps, seconds);
+    }
+
+    if(selected("generate_field")){
+      World world(0.0001, referenceFieldMotor(size), Controller());
+      double seconds = bestSeconds([&](){
+        world.generateField(0);
+      });
+      Motor& motor = world.getMotor();
+      report("generate_field", size, double(dim) * dim * (coilSegments(motor.getCoils()) + magnetSegments(motor.getMagnets())), seconds);
+    }
+
+    if(selected("generate_force_field") && size < 1){
+      World world(0.0001, referenceFieldMotor(size), Controller());
+      world.generateField(0);
+      double seconds = bestSeconds([&](){
+        world.generateForceField();
+      });
+      // Test dipole has 4 segments
+      Motor& motor = world.getMotor();
+      report("generate_force_field", size, 4.0 * dim * dim * (coilSegments(motor.getCoils()) + magnetSegments(motor.getMagnets())), seconds);
+    }
+  }
+  return results;
+}
+
+
+static std::map<std::string, double> readBaseline(const std::string& path){
+  std::map<std::string, double> baseline;
+  std::ifstream file(path);
+  std::string line;
+  while(std::getline(file, line)){
+    std::stringstream fields(line);
+    std::string name, size, ns;
+    if(std::getline(fields, name, ',') && std::getline(fields, size, ',') && std::getline(fields, ns, ',') && name != "name"){
+      baseline[name + "," + size] = atof(ns.c_str());
+    }
+  }
+  return baseline;
+}
+
+
+static bool writeBaseline(const std::string& path, const std::vector<BenchResult>& results){
+  std::ofstream file(path);
+  if(!file){
+    return false;
+  }
+  file << "name,size,ns_per_interaction" << std::endl;
+  for(int i = 0; i < results.size(); i++){
+    file << results[i].name << "," << results[i].size << "," << results[i].ns_per_interaction << std::endl;
+  }
+  return true;
+}
+
+
+int main(int argc, char** argv){
+  std::string baseline_path;
+  std::string filter;
+  bool update = false;
+  double threshold = 1.25;
+
+  for(int i = 1; i < argc; i++){
+    std::string arg = argv[i];
+    if(arg == "--baseline" && i + 1 < argc){
+      baseline_path = argv[++i];
+    }else if(arg == "--update"){
+      update = true;
+    }else if(arg == "--threshold" && i + 1 < argc){
+      threshold = atof(argv[++i]);
+    }else if(arg == "--filter" && i + 1 < argc){
+      filter = argv[++i];
+    }else{
+      std::cout << "Usage: bench.out [--baseline file] [--update] [--threshold 1.25] [--filter name]" << std::endl;
+      return 1;
+    }
+  }
+
+  std::cout << "name,size,ns_per_interaction,interactions,seconds" << std::endl;
+  std::vector<BenchResult> results = runBenchmarks(filter);
+
+  if(baseline_path.empty()){
+    return 0;
+  }
+  if(update){
+    if(!writeBaseline(baseline_path, results)){
+      std::cout << "Could not write " << baseline_path << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  std::map<std::string, double> baseline = readBaseline(baseline_path);
+  int regressions = 0;
+  for(int i = 0; i < results.size(); i++){
+    auto it = baseline.find(results[i].name + "," + results[i].size);
+    if(it == baseline.end()){
+      std::cerr << "No baseline for " << results[i].name << "," << results[i].size << std::endl;
+      continue;
+    }
+    double ratio = results[i].ns_per_interaction / it->second;
+    if(ratio > threshold){
+      std::cerr << "Regression " << results[i].name << "," << results[i].size << ": " << results[i].ns_per_interaction << " ns vs baseline " << it->second << " ns (" << ratio << "x)" << std::endl;
+      regressions++;
+    }
+  }
+  return regressions > 0;
+}
@@ -5,6 +5,8 @@
 #include <cmath>
 #include <iomanip>
 #include <string>
+#include <vector>
+#include <sstream>
 
 // opencv
 #include <opencv2/core/core.hpp>
@@ -20,9 +22,11 @@
 #include "Dipole.hpp"
 #include "World.hpp"
 #include "Controller.hpp"
+#include "ImageWriter.hpp"
+#include "Trace.hpp"
 
 
-/* 
+/*
   Simulation of motor dynamics:
     V1: Render magnetic fields from coils and dipoles
     V2: Simulate torque and other dynamics on motor from magnetic field
@@ -30,6 +34,9 @@
 
   World class keeps track of time. All other classes has an update function which takes the world time as input and updates according to their dt
 
+  Usage: main.out [--headless] [--render north_south,vector_field,magnitude_field,motor] [--out figures] [--format png|exr] [--trace trace.json]
+  Without --headless the north-south render is also shown in a window until 'q' is pressed.
+  --trace writes scoped timings and counters as Chrome trace JSON, in builds made with make TRACE=1.
  */
 
 
@@ -37,10 +44,47 @@
 void onMouse (int event, int y, int x, int flags, void* param);
 
 
+static void printUsage(){
+  std::cout << "Usage: main.out [--headless] [--render north_south,vector_field,magnitude_field,motor] [--out figures] [--format png|exr] [--trace trace.json]" << std::endl;
+}
+
+
+int main(int argc, char** argv){
+  bool headless = false;
+  std::string render_list = "north_south";
+  std::string out_dir = "figures";
+  std::string format = "png";
+  std::string trace_path;
+
+  for(int i = 1; i < argc; i++){
+    std::string arg = argv[i];
+    if(arg == "--headless"){
+      headless = true;
+    }else if(arg == "--render" && i + 1 < argc){
+      render_list = argv[++i];
+    }else if(arg == "--out" && i + 1 < argc){
+      out_dir = argv[++i];
+    }else if(arg == "--format" && i + 1 < argc){
+      format = argv[++i];
+    }else if(arg == "--trace" && i + 1 < argc){
+      trace_path = argv[++i];
+    }else{
+      printUsage();
+      return 1;
+    }
+  }
+
+  std::vector<std::string> renders;
+  std::stringstream render_stream(render_list);
+  for(std::string name; std::getline(render_stream, name, ',');){
+    if(name != "north_south" && name != "vector_field" && name != "magnitude_field" && name != "motor"){
+      std::cout << "Unknown render " << name << std::endl;
+      printUsage();
+      return 1;
+    }
+    renders.push_back(name);
+  }
 
-int main(){
-  std::string name = "window";
-  cv::namedWindow(name);
   Motor motor(1, 0, 10, 0.00001);
   motor.generateCoils(300, -150, 70, 4, 30);
   // motor.generateMagnets(1, 1000, 1, 1, 180, 8);
@@ -53,40 +97,67 @@ int main(){
 
   motor.setCurrentVector(angle, 300);
 
-  cv::Mat motor_render = motor.renderMotor();
-
-  // cv::setMouseCallback(name, onMouse, (void*)&world);
-
   World world(0.0001, motor, controller);
-
-  world.generateField(0);
-  // cv::Mat vector_field = world.renderVectorField();
-  // cv::Mat magnitude_field = world.renderMagnitudeField();
-
-  world.generateForceField();
-  cv::Mat north_south = world.renderNorthSouth();
-
-  // cv::imwrite("figures/magnetic_fields/stator_magnetude.png", magnitude_field);
-  // cv::imwrite("figures/magnetic_fields/stator_north_south.png", north_south);
-  // cv::imwrite("figures/magnetic_fields/stator_render.png", motor_render);
+  ImageWriter writer;
+
+  // Fields are only generated when a selected render needs them
+  bool field_ready = false;
+  bool force_field_ready = false;
+  cv::Mat north_south;
+
+  for(int i = 0; i < renders.size(); i++){
+    cv::Mat image;
+    if(renders[i] == "motor"){
+      image = world.renderMotor();
+    }else{
+      if(!field_ready){
+        world.generateField(0);
+        field_ready = true;
+      }
+      if(renders[i] == "vector_field"){
+        image = world.renderVectorField();
+      }else if(renders[i] == "magnitude_field"){
+        image = world.renderMagnitudeField();
+      }else{
+        if(!force_field_ready){
+          world.generateForceField();
+          force_field_ready = true;
+        }
+        image = world.renderNorthSouth();
+        north_south = image;
+      }
+    }
+    writer.write(out_dir + "/" + renders[i] + "." + format, image);
+  }
 
   // Coil coil(500,175, 4, 0, cv::Point2d(0, 0), 50, 30, 0.00001);
   // cv::Mat canvas = cv::Mat(canvas_size, CV_8UC3, cv::Scalar(0));
   // cv::Mat img1 = coil.renderCoil_xz(canvas);
   // cv::imwrite("figures/coil_4t_30res.png", img1);
-  cv::imwrite("figures/north_south.png", north_south);
-  // cv::Mat img2 = coil.renderCoil_yz();
-  // cv::Mat img3 = coil.renderCoil_xy();
 
+  if(!trace_path.empty()){
+    Trace::writeChromeTrace(trace_path);
+  }
+
+  if(headless){
+    writer.flush();
+    return 0;
+  }
+
+  if(north_south.empty()){
+    if(!field_ready){
+      world.generateField(0);
+    }
+    world.generateForceField();
+    north_south = world.renderNorthSouth();
+  }
+
+  std::string name = "window";
+  cv::namedWindow(name);
+  cv::setMouseCallback(name, onMouse, (void*)&world);
 
   while(1){
-    // cv::imshow("motor", motor_render);
-    // cv::imshow("vector", vector_field);
-    // cv::imshow("magnitude", magnitude_field);
     cv::imshow(name, north_south);
-    // cv::imshow(name, img1);
-    // cv::imshow("yz", img2);
-    // cv::imshow("xy", img3);
 
     char key = cv::waitKey(100);
     if(key == 'q'){
@@ -100,7 +171,6 @@ int main(){
 void onMouse (int event, int x, int y, int flags, void* param){
   World& world = *((World*)param);
   if(event == cv::EVENT_LBUTTONDOWN){
-    std::cout << world.getForceField()[y][x] << std::endl;
+    std::cout << world.getForceField().get(y, x) << std::endl;
   }
 }
-
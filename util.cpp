@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <cmath>
 #include <iomanip>
+#include <immintrin.h>
 
 // opencv
 #include <opencv2/core/core.hpp>
@@ -50,45 +51,154 @@ cv::Vec3d rotateVector3D_z(cv::Vec3d vector, float angle){
 }
 
 
-cv::Vec2d clark(cv::Vec3d uvw){
-  cv::Mat clark = cv::Mat_<float>(2, 3);
-  cv::Mat uvw_mat = (cv::Mat_<float>(3, 1) << uvw[0], uvw[1], uvw[2]);
+// Same rotation with precomputed cos and sin, for hot loops
+cv::Vec3d rotateVector3D_z(const cv::Vec3d& vector, double cos_angle, double sin_angle){
+  return cv::Vec3d(vector[0]*cos_angle - vector[1]*sin_angle, vector[0]*sin_angle + vector[1]*cos_angle, vector[2]);
+}
 
-  clark.at<float>(0, 0) = 1;
-  clark.at<float>(0, 1) = -1.0/2.0;
-  clark.at<float>(0, 2) = -1.0/2.0;
-  clark.at<float>(1, 0) = 0;
-  clark.at<float>(1, 1) = sqrt(3)/2.0;
-  clark.at<float>(1, 2) = -sqrt(3)/2.0;
 
-  cv::Mat ab = 2.0/3.0 * clark * uvw_mat;
+// Transform coefficients
+static constexpr double CLARK_A = 2.0/3.0;
+static constexpr double CLARK_B = 1.0/3.0;
+static constexpr double INV_SQRT3 = 0.57735026918962576451;
+static constexpr double HALF_SQRT3 = 0.86602540378443864676;
 
-  cv::Vec2d ab_vec(0, 0);
-  ab_vec[0] = ab.at<float>(0, 0);
-  ab_vec[1] = ab.at<float>(1, 0);
 
-  return ab_vec; 
+cv::Vec2d clark(cv::Vec3d uvw){
+  // alpha = 2/3 (u - v/2 - w/2), beta = (v - w) / sqrt(3)
+  return cv::Vec2d(CLARK_A * uvw[0] - CLARK_B * (uvw[1] + uvw[2]), INV_SQRT3 * (uvw[1] - uvw[2]));
 }
 
 
 cv::Vec3d clarkInv(cv::Vec2d ab){
-  cv::Mat clark_inv = cv::Mat_<float>(3, 2);
-  cv::Mat ab_mat = (cv::Mat_<float>(2, 1) << ab[0], ab[1]);
+  // u = alpha, v = -alpha/2 + sqrt(3)/2 beta, w = -alpha/2 - sqrt(3)/2 beta
+  return cv::Vec3d(ab[0], -0.5 * ab[0] + HALF_SQRT3 * ab[1], -0.5 * ab[0] - HALF_SQRT3 * ab[1]);
+}
+
+
+cv::Vec2d park(cv::Vec2d ab, double theta){
+  return park(ab, cos(theta), sin(theta));
+}
 
-  clark_inv.at<float>(0, 0) = 2.0/3.0;
-  clark_inv.at<float>(0, 1) = 0;
-  clark_inv.at<float>(1, 0) = -1.0/3.0;
-  clark_inv.at<float>(1, 1) = sqrt(3)/3.0;
-  clark_inv.at<float>(2, 0) = -1.0/3.0;
-  clark_inv.at<float>(2, 1) = -sqrt(3)/3.0;
 
-  cv::Mat uvw = 3.0/2.0 * clark_inv * ab_mat;
+cv::Vec2d park(cv::Vec2d ab, double cos_theta, double sin_theta){
+  return cv::Vec2d(ab[0] * cos_theta + ab[1] * sin_theta, -ab[0] * sin_theta + ab[1] * cos_theta);
+}
 
-  cv::Vec3d uvw_vec(0, 0, 0);
-  uvw_vec[0] = uvw.at<float>(0, 0);
-  uvw_vec[1] = uvw.at<float>(1, 0);
-  uvw_vec[2] = uvw.at<float>(2, 0);
 
-  return uvw_vec;
+cv::Vec2d parkInv(cv::Vec2d dq, double theta){
+  return parkInv(dq, cos(theta), sin(theta));
 }
 
+
+cv::Vec2d parkInv(cv::Vec2d dq, double cos_theta, double sin_theta){
+  return cv::Vec2d(dq[0] * cos_theta - dq[1] * sin_theta, dq[0] * sin_theta + dq[1] * cos_theta);
+}
+
+
+static bool cpuHasAVX2(){
+  static const bool has_avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"));
+  return has_avx2;
+}
+
+
+__attribute__((target("avx2,fma")))
+static size_t clarkBatchAVX2(const double* u, const double* v, const double* w, double* alpha, double* beta, size_t n){
+  __m256d a = _mm256_set1_pd(CLARK_A);
+  __m256d b = _mm256_set1_pd(CLARK_B);
+  __m256d s = _mm256_set1_pd(INV_SQRT3);
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4){
+    __m256d u4 = _mm256_loadu_pd(u + i);
+    __m256d v4 = _mm256_loadu_pd(v + i);
+    __m256d w4 = _mm256_loadu_pd(w + i);
+    _mm256_storeu_pd(alpha + i, _mm256_fmsub_pd(a, u4, _mm256_mul_pd(b, _mm256_add_pd(v4, w4))));
+    _mm256_storeu_pd(beta + i, _mm256_mul_pd(s, _mm256_sub_pd(v4, w4)));
+  }
+  return i;
+}
+
+
+__attribute__((target("avx2,fma")))
+static size_t clarkInvBatchAVX2(const double* alpha, const double* beta, double* u, double* v, double* w, size_t n){
+  __m256d half = _mm256_set1_pd(-0.5);
+  __m256d s = _mm256_set1_pd(HALF_SQRT3);
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4){
+    __m256d a4 = _mm256_loadu_pd(alpha + i);
+    __m256d b4 = _mm256_loadu_pd(beta + i);
+    __m256d h = _mm256_mul_pd(half, a4);
+    _mm256_storeu_pd(u + i, a4);
+    _mm256_storeu_pd(v + i, _mm256_fmadd_pd(s, b4, h));
+    _mm256_storeu_pd(w + i, _mm256_fnmadd_pd(s, b4, h));
+  }
+  return i;
+}
+
+
+__attribute__((target("avx2,fma")))
+static size_t parkBatchAVX2(const double* alpha, const double* beta, const double* cos_theta, const double* sin_theta, double* d, double* q, size_t n){
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4){
+    __m256d a4 = _mm256_loadu_pd(alpha + i);
+    __m256d b4 = _mm256_loadu_pd(beta + i);
+    __m256d c4 = _mm256_loadu_pd(cos_theta + i);
+    __m256d s4 = _mm256_loadu_pd(sin_theta + i);
+    _mm256_storeu_pd(d + i, _mm256_fmadd_pd(a4, c4, _mm256_mul_pd(b4, s4)));
+    _mm256_storeu_pd(q + i, _mm256_fmsub_pd(b4, c4, _mm256_mul_pd(a4, s4)));
+  }
+  return i;
+}
+
+
+__attribute__((target("avx2,fma")))
+static size_t parkInvBatchAVX2(const double* d, const double* q, const double* cos_theta, const double* sin_theta, double* alpha, double* beta, size_t n){
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4){
+    __m256d d4 = _mm256_loadu_pd(d + i);
+    __m256d q4 = _mm256_loadu_pd(q + i);
+    __m256d c4 = _mm256_loadu_pd(cos_theta + i);
+    __m256d s4 = _mm256_loadu_pd(sin_theta + i);
+    _mm256_storeu_pd(alpha + i, _mm256_fmsub_pd(d4, c4, _mm256_mul_pd(q4, s4)));
+    _mm256_storeu_pd(beta + i, _mm256_fmadd_pd(d4, s4, _mm256_mul_pd(q4, c4)));
+  }
+  return i;
+}
+
+
+// Each batch runs the AVX2 loop when available and finishes the remainder in scalar code
+void clarkBatch(const double* u, const double* v, const double* w, double* alpha, double* beta, size_t n){
+  size_t i = cpuHasAVX2() ? clarkBatchAVX2(u, v, w, alpha, beta, n) : 0;
+  for(; i < n; i++){
+    alpha[i] = CLARK_A * u[i] - CLARK_B * (v[i] + w[i]);
+    beta[i] = INV_SQRT3 * (v[i] - w[i]);
+  }
+}
+
+
+void clarkInvBatch(const double* alpha, const double* beta, double* u, double* v, double* w, size_t n){
+  size_t i = cpuHasAVX2() ? clarkInvBatchAVX2(alpha, beta, u, v, w, n) : 0;
+  for(; i < n; i++){
+    u[i] = alpha[i];
+    v[i] = -0.5 * alpha[i] + HALF_SQRT3 * beta[i];
+    w[i] = -0.5 * alpha[i] - HALF_SQRT3 * beta[i];
+  }
+}
+
+
+void parkBatch(const double* alpha, const double* beta, const double* cos_theta, const double* sin_theta, double* d, double* q, size_t n){
+  size_t i = cpuHasAVX2() ? parkBatchAVX2(alpha, beta, cos_theta, sin_theta, d, q, n) : 0;
+  for(; i < n; i++){
+    d[i] = alpha[i] * cos_theta[i] + beta[i] * sin_theta[i];
+    q[i] = -alpha[i] * sin_theta[i] + beta[i] * cos_theta[i];
+  }
+}
+
+
+void parkInvBatch(const double* d, const double* q, const double* cos_theta, const double* sin_theta, double* alpha, double* beta, size_t n){
+  size_t i = cpuHasAVX2() ? parkInvBatchAVX2(d, q, cos_theta, sin_theta, alpha, beta, n) : 0;
+  for(; i < n; i++){
+    alpha[i] = d[i] * cos_theta[i] - q[i] * sin_theta[i];
+    beta[i] = d[i] * sin_theta[i] + q[i] * cos_theta[i];
+  }
+}
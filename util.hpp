@@ -25,6 +25,21 @@ struct FieldVector{
   cv::Vec3d dir = cv::Vec3d(0, 0, 0);
 };
 
+
+// Read-only view of contiguous elements owned elsewhere, valid until the owner reallocates
+template <typename T> class ConstView {
+  const T* first;
+  size_t count;
+public:
+  ConstView(const T* _first, size_t _count) : first(_first), count(_count) {}
+  ConstView(const std::vector<T>& v) : first(v.data()), count(v.size()) {}
+  const T* begin() const { return first; }
+  const T* end() const { return first + count; }
+  const T& operator[](size_t i) const { return first[i]; }
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+};
+
 extern const uint16_t dim;
 extern cv::Size canvas_size;
 
@@ -34,7 +49,20 @@ cv::Point posToPixel(cv::Point p);
 cv::Point2d posOnCircle(float r, float angle);
 cv::Point2d rotateVector2D(cv::Point2d vector, float angle);
 cv::Vec3d rotateVector3D_z(cv::Vec3d vector, float angle);
+cv::Vec3d rotateVector3D_z(const cv::Vec3d& vector, double cos_angle, double sin_angle);
 
+// Amplitude invariant Clarke transform: uvw <-> alpha-beta
 cv::Vec2d clark(cv::Vec3d);
 cv::Vec3d clarkInv(cv::Vec2d);
+// Park transform: alpha-beta <-> dq at electrical angle theta
+cv::Vec2d park(cv::Vec2d ab, double theta);
+cv::Vec2d park(cv::Vec2d ab, double cos_theta, double sin_theta);
+cv::Vec2d parkInv(cv::Vec2d dq, double theta);
+cv::Vec2d parkInv(cv::Vec2d dq, double cos_theta, double sin_theta);
+
+// Batched transforms over contiguous arrays of n values, no allocation
+void clarkBatch(const double* u, const double* v, const double* w, double* alpha, double* beta, size_t n);
+void clarkInvBatch(const double* alpha, const double* beta, double* u, double* v, double* w, size_t n);
+void parkBatch(const double* alpha, const double* beta, const double* cos_theta, const double* sin_theta, double* d, double* q, size_t n);
+void parkInvBatch(const double* d, const double* q, const double* cos_theta, const double* sin_theta, double* alpha, double* beta, size_t n);
 